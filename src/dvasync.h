@@ -0,0 +1,146 @@
+#pragma once
+
+// Awaitable section reads for C++20 coroutines:
+//
+//   AsyncDVFile file("data.dv");
+//   co_await file.read_section(t, w, z, buffer);
+//
+// Reads are queued to a small pool of dedicated I/O threads that issue positional reads, so any
+// number of requests can be in flight without a thread per request. The awaiting coroutine is
+// resumed on the I/O thread that completed its read.
+
+#if (defined(_MSVC_LANG) ? _MSVC_LANG : __cplusplus) >= 202002L && __has_include(<coroutine>)
+
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "dvfile.h"
+
+// Threads that perform blocking reads on behalf of suspended coroutines.
+class AsyncIOEngine {
+ private:
+  struct Job {
+    void (*run)(void* context);
+    void* context;
+  };
+
+  std::vector<std::thread> _threads;
+  std::deque<Job> _jobs;
+  bool _stop = false;
+  std::mutex _mutex;
+  std::condition_variable _cv;
+
+  void _run() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+      _cv.wait(lock, [&] { return _stop || !_jobs.empty(); });
+      if (_jobs.empty()) return;
+      Job job = _jobs.front();
+      _jobs.pop_front();
+      lock.unlock();
+      job.run(job.context);
+      lock.lock();
+    }
+  }
+
+ public:
+  // I/O threads bound the number of reads the disk sees at once, not the number of requests
+  explicit AsyncIOEngine(unsigned io_threads = 16) {
+    if (io_threads == 0) io_threads = 1;
+    for (unsigned i = 0; i < io_threads; ++i) _threads.emplace_back(&AsyncIOEngine::_run, this);
+  }
+
+  AsyncIOEngine(const AsyncIOEngine&) = delete;
+  AsyncIOEngine& operator=(const AsyncIOEngine&) = delete;
+
+  // Finishes queued jobs, then stops the threads.
+  ~AsyncIOEngine() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+    }
+    _cv.notify_all();
+    for (auto& th : _threads) th.join();
+  }
+
+  void submit(void (*run)(void*), void* context) {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _jobs.push_back({run, context});
+    }
+    _cv.notify_one();
+  }
+
+  // process-wide engine used when none is given
+  static AsyncIOEngine& shared() {
+    static AsyncIOEngine engine;
+    return engine;
+  }
+};
+
+// A DVFile whose sections can be read with co_await.
+class AsyncDVFile {
+ private:
+  std::shared_ptr<const DVFile> _file;
+  AsyncIOEngine* _engine;
+
+ public:
+  class ReadAwaitable {
+   private:
+    std::shared_ptr<const DVFile> _file;  // keeps the file open while the read is queued
+    AsyncIOEngine* _engine;
+    void* _array;
+    int _t, _w, _z;
+    std::coroutine_handle<> _handle;
+    std::exception_ptr _error;
+
+    static void _complete(void* context) {
+      ReadAwaitable* self = static_cast<ReadAwaitable*>(context);
+      try {
+        self->_file->readSecAt(self->_array, self->_t, self->_w, self->_z);
+      } catch (...) {
+        self->_error = std::current_exception();
+      }
+      self->_handle.resume();
+    }
+
+   public:
+    ReadAwaitable(std::shared_ptr<const DVFile> file, AsyncIOEngine* engine, void* array, int t,
+                  int w, int z)
+        : _file(std::move(file)), _engine(engine), _array(array), _t(t), _w(w), _z(z) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+      _handle = handle;
+      _engine->submit(&ReadAwaitable::_complete, this);
+    }
+
+    // rethrows read errors (e.g. an index out of range) in the awaiting coroutine
+    void await_resume() {
+      if (_error) std::rethrow_exception(_error);
+    }
+  };
+
+  explicit AsyncDVFile(const std::string& path, AsyncIOEngine& engine = AsyncIOEngine::shared())
+      : _file(std::make_shared<DVFile>(path)), _engine(&engine) {}
+
+  IW_MRC_Header getHeader() const { return _file->getHeader(); }
+
+  size_t frameSize() const { return _file->frameSize(); }
+
+  // Read section (t, w, z) into array (frameSize() bytes), which must stay valid until resumed.
+  ReadAwaitable read_section(int t, int w, int z, void* array) const {
+    return ReadAwaitable(_file, _engine, array, t, w, z);
+  }
+};
+
+#endif
@@ -0,0 +1,326 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "dvfile.h"
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+// Aligned allocation that works on every platform (std::aligned_alloc is missing on MSVC).
+void* alignedAlloc(size_t size, size_t alignment) {
+  size = (size + alignment - 1) / alignment * alignment;
+#ifdef _WIN32
+  void* p = _aligned_malloc(size, alignment);
+#else
+  void* p = nullptr;
+  if (posix_memalign(&p, alignment, size) != 0) p = nullptr;
+#endif
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void alignedFree(void* p) {
+#ifdef _WIN32
+  _aligned_free(p);
+#else
+  std::free(p);
+#endif
+}
+
+// Allocate `size` bytes backed by huge pages where the OS allows it: explicit huge pages if
+// reserved, else transparent huge pages (Linux); an ordinary aligned allocation elsewhere.
+// Returns the pointer and sets `mapped` to how many bytes must be handed to hugePageFree.
+void* hugePageAlloc(size_t size, size_t& mapped) {
+#if defined(__linux__)
+  const size_t huge = size_t(2) << 20;
+  mapped = (size + huge - 1) / huge * huge;
+  void* p = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                 -1, 0);
+  if (p == MAP_FAILED) {
+    p = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) throw std::bad_alloc();
+    madvise(p, mapped, MADV_HUGEPAGE);
+  }
+  return p;
+#else
+  mapped = 0;
+  return alignedAlloc(size, 4096);
+#endif
+}
+
+void hugePageFree(void* p, size_t mapped) {
+#if defined(__linux__)
+  munmap(p, mapped);
+#else
+  (void)mapped;
+  alignedFree(p);
+#endif
+}
+
+// NUMA node of the CPU the calling thread is running on, or 0 where that cannot be told.
+int currentNumaNode() {
+#if defined(__linux__) && defined(SYS_getcpu)
+  unsigned cpu = 0, node = 0;
+  if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) return static_cast<int>(node);
+#endif
+  return 0;
+}
+
+// Ask for the pages of [p, p + size) to live on `node` (Linux mbind with a preferred policy;
+// nothing elsewhere), moving any already faulted in elsewhere, as reused heap memory may be.
+// Only the whole pages inside the range are affected. Returns false if the kernel refused, e.g.
+// on machines without NUMA support.
+bool preferNumaNode(void* p, size_t size, int node) {
+#if defined(__linux__) && defined(SYS_mbind)
+  const int kPreferred = 1;  // MPOL_PREFERRED, without needing the numa headers
+  const unsigned kMove = 2;  // MPOL_MF_MOVE: migrate pages this process alone maps
+  unsigned long mask[4] = {0, 0, 0, 0};
+  if (node < 0 || node >= static_cast<int>(8 * sizeof(mask))) return false;
+  mask[node / (8 * sizeof(unsigned long))] |= 1ul << (node % (8 * sizeof(unsigned long)));
+  const uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+  const uintptr_t begin = (reinterpret_cast<uintptr_t>(p) + page - 1) / page * page;
+  const uintptr_t end = (reinterpret_cast<uintptr_t>(p) + size) / page * page;
+  if (end <= begin) return false;
+  return syscall(SYS_mbind, reinterpret_cast<void*>(begin), end - begin, kPreferred, mask,
+                 8 * sizeof(mask), kMove) == 0;
+#else
+  (void)p;
+  (void)size;
+  (void)node;
+  return false;
+#endif
+}
+
+struct BufferPoolOptions {
+  size_t alignment = 64;     // power of two; 4096 suits O_DIRECT and page-granular I/O
+  bool hugepages = false;    // back buffers with huge pages where available
+  size_t max_buffers = 1024; // buffers the pool may ever allocate
+  // Place each new buffer on the NUMA node of the thread that first acquires it and hand free
+  // buffers back out on the same node, so consumers read and write local memory.
+  bool numa_local = false;
+};
+
+class SectionBufferPool;
+
+// RAII handle to a pooled buffer; returns the buffer to its pool when destroyed.
+class SectionBuffer {
+ private:
+  SectionBufferPool* _pool = nullptr;
+  uint32_t _index = 0;
+  void* _data = nullptr;
+  size_t _size = 0;
+
+  friend class SectionBufferPool;
+  SectionBuffer(SectionBufferPool* pool, uint32_t index, void* data, size_t size)
+      : _pool(pool), _index(index), _data(data), _size(size) {}
+
+ public:
+  SectionBuffer() = default;
+  SectionBuffer(const SectionBuffer&) = delete;
+  SectionBuffer& operator=(const SectionBuffer&) = delete;
+  SectionBuffer(SectionBuffer&& other) noexcept { *this = std::move(other); }
+  SectionBuffer& operator=(SectionBuffer&& other) noexcept;
+  ~SectionBuffer() { reset(); }
+
+  void reset();
+
+  void* data() { return _data; }
+  const void* data() const { return _data; }
+
+  template <typename T>
+  T* as() {
+    return static_cast<T*>(_data);
+  }
+
+  size_t size() const { return _size; }
+
+  explicit operator bool() const { return _data != nullptr; }
+};
+
+/**
+ * Reusable, aligned section buffers for read loops.
+ *
+ * Free buffers sit on 16 lock-free stacks shared by thread-id hash (not one per thread).
+ * Each thread pushes to and pops from the stack its id hashes to and only looks at the others
+ * when its own is empty, so threads rarely touch the same cache line. Once every thread has
+ * warmed up, acquire/release never allocate. The pool must outlive the buffers it hands out.
+ */
+class SectionBufferPool {
+ private:
+  static const size_t kStacks = 16;
+  static const size_t kVacant = kStacks;  // extra stack of slots whose allocation failed
+
+  struct Block {
+    void* data = nullptr;
+    size_t mapped = 0;
+    size_t stack = 0;  // free list the block returns to
+    std::atomic<uint32_t> next{0};  // 1-based index of the next free block, 0 = none
+  };
+
+  // head = (tag << 32) | 1-based block index; the tag changes on every update to defeat ABA
+  struct alignas(64) Stack {
+    std::atomic<uint64_t> head{0};
+  };
+
+  size_t _size;
+  BufferPoolOptions _options;
+  std::unique_ptr<Block[]> _blocks;
+  std::atomic<uint32_t> _allocated{0};
+  std::atomic<uint32_t> _vacant{0};  // slots on the kVacant stack
+  Stack _stacks[kStacks + 1];
+
+  static size_t _threadSlot() {
+    thread_local size_t slot = std::hash<std::thread::id>()(std::this_thread::get_id()) % kStacks;
+    return slot;
+  }
+
+  // with numa_local the stacks are per node rather than per thread
+  size_t _homeStack() const {
+    return _options.numa_local ? static_cast<size_t>(currentNumaNode()) % kStacks : _threadSlot();
+  }
+
+  void _push(size_t stack, uint32_t index) {
+    std::atomic<uint64_t>& head = _stacks[stack].head;
+    uint64_t old = head.load(std::memory_order_relaxed);
+    uint64_t next;
+    do {
+      _blocks[index - 1].next.store(static_cast<uint32_t>(old), std::memory_order_relaxed);
+      next = ((old >> 32) + 1) << 32 | index;
+    } while (!head.compare_exchange_weak(old, next, std::memory_order_release,
+                                         std::memory_order_relaxed));
+  }
+
+  uint32_t _pop(size_t stack) {
+    std::atomic<uint64_t>& head = _stacks[stack].head;
+    uint64_t old = head.load(std::memory_order_acquire);
+    while (true) {
+      uint32_t index = static_cast<uint32_t>(old);
+      if (index == 0) return 0;
+      uint32_t after = _blocks[index - 1].next.load(std::memory_order_relaxed);
+      uint64_t next = ((old >> 32) + 1) << 32 | after;
+      if (head.compare_exchange_weak(old, next, std::memory_order_acquire,
+                                     std::memory_order_acquire)) {
+        return index;
+      }
+    }
+  }
+
+ public:
+  explicit SectionBufferPool(size_t buffer_size,
+                             const BufferPoolOptions& options = BufferPoolOptions())
+      : _size(buffer_size), _options(options), _blocks(new Block[options.max_buffers]) {
+    if (_options.alignment == 0 || (_options.alignment & (_options.alignment - 1)) != 0) {
+      throw std::runtime_error("Buffer alignment must be a power of two");
+    }
+    // node placement works on whole pages
+    if (_options.numa_local) _options.alignment = std::max<size_t>(_options.alignment, 4096);
+  }
+
+  // buffers sized for one section of `file`
+  explicit SectionBufferPool(const DVFile& file,
+                             const BufferPoolOptions& options = BufferPoolOptions())
+      : SectionBufferPool(file.frameSize(), options) {}
+
+  SectionBufferPool(const SectionBufferPool&) = delete;
+  SectionBufferPool& operator=(const SectionBufferPool&) = delete;
+
+  ~SectionBufferPool() {
+    for (uint32_t i = 0; i < _allocated.load(); ++i) {
+      if (_blocks[i].data == nullptr) continue;
+      if (_options.hugepages) {
+        hugePageFree(_blocks[i].data, _blocks[i].mapped);
+      } else {
+        alignedFree(_blocks[i].data);
+      }
+    }
+  }
+
+  // Take a free buffer, allocating a new one only if none is free. Contents are unspecified.
+  SectionBuffer acquire() {
+    size_t home = _homeStack();
+    // NUMA-local pools prefer a fresh local buffer over a free one on another node
+    const size_t search = _options.numa_local ? 1 : kStacks;
+    for (size_t i = 0; i < search; ++i) {
+      if (uint32_t index = _pop((home + i) % kStacks)) {
+        return SectionBuffer(this, index, _blocks[index - 1].data, _size);
+      }
+    }
+    // reuse a slot left empty by a failed allocation before claiming a new one
+    uint32_t index = _pop(kVacant);
+    if (index) {
+      _vacant.fetch_sub(1);
+    } else {
+      index = _allocated.fetch_add(1) + 1;
+    }
+    if (index > _options.max_buffers) {
+      _allocated.fetch_sub(1);
+      for (size_t i = 1; i < kStacks && _options.numa_local; ++i) {
+        if (uint32_t stolen = _pop((home + i) % kStacks)) {
+          return SectionBuffer(this, stolen, _blocks[stolen - 1].data, _size);
+        }
+      }
+      throw std::runtime_error("Section buffer pool exhausted");
+    }
+    Block& block = _blocks[index - 1];
+    try {
+      block.data = _options.hugepages ? hugePageAlloc(_size, block.mapped)
+                                      : alignedAlloc(_size, _options.alignment);
+    } catch (...) {
+      // hand the slot to the next acquire rather than losing it
+      block.data = nullptr;
+      block.mapped = 0;
+      _vacant.fetch_add(1);
+      _push(kVacant, index);
+      throw;
+    }
+    if (_options.numa_local) {
+      const int node = currentNumaNode();
+      const size_t bytes = block.mapped ? block.mapped
+                                        : (_size + _options.alignment - 1) / _options.alignment *
+                                              _options.alignment;
+      preferNumaNode(block.data, bytes, node);
+      std::memset(block.data, 0, bytes);  // first touch places the pages here too
+      block.stack = static_cast<size_t>(node) % kStacks;
+    }
+    return SectionBuffer(this, index, block.data, _size);
+  }
+
+  void release(uint32_t index) {
+    _push(_options.numa_local ? _blocks[index - 1].stack : _threadSlot(), index);
+  }
+
+  size_t bufferSize() const { return _size; }
+
+  // number of buffers allocated so far (in use or free)
+  size_t allocated() const { return _allocated.load() - _vacant.load(); }
+};
+
+inline SectionBuffer& SectionBuffer::operator=(SectionBuffer&& other) noexcept {
+  if (this != &other) {
+    reset();
+    _pool = other._pool;
+    _index = other._index;
+    _data = other._data;
+    _size = other._size;
+    other._pool = nullptr;
+    other._data = nullptr;
+  }
+  return *this;
+}
+
+inline void SectionBuffer::reset() {
+  if (_pool != nullptr) _pool->release(_index);
+  _pool = nullptr;
+  _data = nullptr;
+}
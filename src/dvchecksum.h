@@ -0,0 +1,282 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define DV_CRC32C_X86 1
+#elif defined(_M_X64) && defined(_MSC_VER)
+#include <intrin.h>
+#include <nmmintrin.h>
+#define DV_CRC32C_X86 1
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#include "dvfile.h"
+#include "dvparallel.h"
+
+// Per-section CRC32C checksums kept in a text sidecar next to a DV file, so copies can be checked
+// in parallel and damage pinned down to individual (t, w, z) planes.
+//
+// Sidecar layout (one record per line, checksums in hex):
+//   DVCRC32C 1 <frame bytes> <sections>
+//   header <crc of the header and extended header>
+//   <t> <w> <z> <crc>                    one line per section, in file order
+
+namespace crc32c_detail {
+
+// Slicing-by-8 tables for the Castagnoli polynomial (reflected 0x82F63B78).
+struct Tables {
+  uint32_t t[8][256];
+
+  Tables() {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k) c = (c >> 1) ^ (0x82F63B78u & (0u - (c & 1)));
+      t[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+      for (int s = 1; s < 8; ++s) t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xFF];
+    }
+  }
+};
+
+inline const Tables& tables() {
+  static const Tables instance;
+  return instance;
+}
+
+// The kernels below take and return the inverted running value.
+inline uint32_t table(const uint8_t* p, size_t size, uint32_t c) {
+  const auto& t = tables().t;
+  for (; size >= 8; size -= 8, p += 8) {
+    // little-endian word order regardless of the host
+    uint32_t lo = (p[0] | p[1] << 8 | p[2] << 16 | static_cast<uint32_t>(p[3]) << 24) ^ c;
+    uint32_t hi = p[4] | p[5] << 8 | p[6] << 16 | static_cast<uint32_t>(p[7]) << 24;
+    c = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+        t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+  }
+  for (; size > 0; --size) c = (c >> 8) ^ t[0][(c ^ *p++) & 0xFF];
+  return c;
+}
+
+#if defined(DV_CRC32C_X86)
+// Compiled for SSE 4.2 whatever the build targets; only called once the CPU is known to have it.
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((target("sse4.2")))
+#endif
+inline uint32_t sse42(const uint8_t* p, size_t size, uint32_t c) {
+  uint64_t c64 = c;
+  for (; size >= 8; size -= 8, p += 8) {
+    uint64_t word;
+    std::memcpy(&word, p, 8);
+    c64 = _mm_crc32_u64(c64, word);
+  }
+  c = static_cast<uint32_t>(c64);
+  for (; size > 0; --size) c = _mm_crc32_u8(c, *p++);
+  return c;
+}
+
+inline bool hasSse42() {
+#if defined(__SSE4_2__)
+  return true;
+#elif defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 1);
+  return (info[2] & (1 << 20)) != 0;
+#else
+  return __builtin_cpu_supports("sse4.2");
+#endif
+}
+#endif
+
+}  // namespace crc32c_detail
+
+/**
+ * CRC32C of `size` bytes, continuing from `crc` (the result of a previous call, or 0). Uses the
+ * CRC32 instruction on x86-64 CPUs with SSE 4.2 (checked at run time, so default builds get it
+ * too) and on builds targeting ARMv8 CRC, and a slicing-by-8 table otherwise; all paths give the
+ * same result.
+ */
+uint32_t crc32c(const void* data, size_t size, uint32_t crc = 0) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  uint32_t c = ~crc;
+#if defined(DV_CRC32C_X86)
+  static const bool hardware = crc32c_detail::hasSse42();
+  c = hardware ? crc32c_detail::sse42(p, size, c) : crc32c_detail::table(p, size, c);
+#elif defined(__ARM_FEATURE_CRC32)
+  for (; size >= 8; size -= 8, p += 8) {
+    uint64_t word;
+    std::memcpy(&word, p, 8);
+    c = __crc32cd(c, word);
+  }
+  for (; size > 0; --size) c = __crc32cb(c, *p++);
+#else
+  c = crc32c_detail::table(p, size, c);
+#endif
+  return ~c;
+}
+
+std::string checksumSidecarPath(const std::string& path) { return path + ".crc32c"; }
+
+struct SectionChecksums {
+  uint64_t frame_bytes = 0;
+  uint32_t header = 0;             // header plus extended header
+  std::vector<uint32_t> sections;  // in file order
+};
+
+// A section whose data no longer matches its recorded checksum.
+struct DamagedSection {
+  int t, w, z;
+  uint32_t expected;
+  uint32_t actual;
+  bool readable;  // false if the section lies past the end of the file
+};
+
+/**
+ * Checksum the header and every section of a DV file as stored on disk (the file's own byte
+ * order), with `threads` readers (0 = one per core). Sections that cannot be read get checksum
+ * 0 and are listed in `unreadable` if it is given.
+ */
+SectionChecksums computeChecksums(const std::string& path, unsigned threads = 0,
+                                  std::vector<size_t>* unreadable = nullptr) {
+  // the layout comes from the header alone, so truncated files can still be checked
+  PositionalFile in(path);
+  const IW_MRC_Header hdr = peekHeader(in);
+  const std::string problem = headerProblem(hdr, UINT64_MAX);
+  if (!problem.empty()) {
+    throw std::runtime_error(path + " has an invalid header: " + problem);
+  }
+  const uint64_t data_offset = 1024 + static_cast<uint64_t>(hdr.inbsym);
+  const size_t frame = static_cast<size_t>(hdr.nx) * hdr.ny *
+                       getPixelTypeSize(static_cast<PixelType>(hdr.mode));
+  const size_t count = static_cast<size_t>(hdr.nz);
+  SectionChecksums sums;
+  sums.frame_bytes = frame;
+  std::vector<char> head(std::min<uint64_t>(data_offset, in.size()));
+  in.read(head.data(), head.size(), 0);
+  sums.header = crc32c(head.data(), head.size());
+
+  if (threads == 0) threads = defaultThreadCount();
+  sums.sections.assign(count, 0);
+  std::vector<char> failed(count, 0);
+  std::vector<std::vector<char>> buffers(threads);
+  parallelForStealing(
+      count,
+      [&](size_t i, unsigned worker) {
+        std::vector<char>& buffer = buffers[worker];
+        buffer.resize(frame);
+        try {
+          in.read(buffer.data(), frame, data_offset + i * frame);
+        } catch (const std::runtime_error&) {
+          failed[i] = 1;
+          return;
+        }
+        sums.sections[i] = crc32c(buffer.data(), frame);
+      },
+      threads);
+  if (unreadable) {
+    unreadable->clear();
+    for (size_t i = 0; i < count; ++i) {
+      if (failed[i]) unreadable->push_back(i);
+    }
+  }
+  return sums;
+}
+
+// Write the checksums of `path` to `sidecar` (checksumSidecarPath(path) if empty).
+void writeChecksums(const std::string& path, const std::string& sidecar = "",
+                    unsigned threads = 0) {
+  std::vector<size_t> unreadable;
+  SectionChecksums sums = computeChecksums(path, threads, &unreadable);
+  if (!unreadable.empty()) {
+    throw std::runtime_error(path + " is truncated; cannot record its checksums");
+  }
+  IW_MRC_Header hdr = DVFile(path).getHeader();
+
+  std::ofstream out(sidecar.empty() ? checksumSidecarPath(path) : sidecar, std::ios::trunc);
+  if (!out) {
+    throw std::runtime_error("Failed to create checksum file");
+  }
+  char hex[16];
+  out << "DVCRC32C 1 " << sums.frame_bytes << " " << sums.sections.size() << "\n";
+  std::snprintf(hex, sizeof(hex), "%08x", sums.header);
+  out << "header " << hex << "\n";
+  for (size_t i = 0; i < sums.sections.size(); ++i) {
+    int t, w, z;
+    hdr.section_zwt(static_cast<int>(i), t, w, z);
+    std::snprintf(hex, sizeof(hex), "%08x", sums.sections[i]);
+    out << t << " " << w << " " << z << " " << hex << "\n";
+  }
+  if (!out) {
+    throw std::runtime_error("Failed to write checksum file");
+  }
+}
+
+// Checksums recorded by writeChecksums.
+SectionChecksums readChecksums(const std::string& sidecar) {
+  std::ifstream in(sidecar);
+  std::string magic, label;
+  int version = 0;
+  size_t count = 0;
+  SectionChecksums sums;
+  if (!(in >> magic >> version >> sums.frame_bytes >> count) || magic != "DVCRC32C" ||
+      version != 1) {
+    throw std::runtime_error(sidecar + " is not a checksum file");
+  }
+  if (!(in >> label >> std::hex >> sums.header) || label != "header") {
+    throw std::runtime_error("Corrupt checksum file");
+  }
+  sums.sections.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    int t, w, z;
+    if (!(in >> std::dec >> t >> w >> z >> std::hex >> sums.sections[i])) {
+      throw std::runtime_error("Corrupt checksum file");
+    }
+  }
+  return sums;
+}
+
+/**
+ * Re-read `path` with `threads` readers and compare every section against the checksums in
+ * `sidecar` (checksumSidecarPath(path) if empty). Returns the damaged sections in file order;
+ * an empty result means the data is intact. `header_ok`, if given, reports whether the header and
+ * extended header still match. Throws if the file's layout no longer matches the sidecar.
+ */
+std::vector<DamagedSection> verifyChecksums(const std::string& path,
+                                            const std::string& sidecar = "",
+                                            unsigned threads = 0, bool* header_ok = nullptr) {
+  SectionChecksums expected = readChecksums(sidecar.empty() ? checksumSidecarPath(path) : sidecar);
+  std::vector<size_t> unreadable;
+  SectionChecksums actual = computeChecksums(path, threads, &unreadable);
+  if (actual.frame_bytes != expected.frame_bytes ||
+      actual.sections.size() != expected.sections.size()) {
+    throw std::runtime_error(path + " no longer has the layout its checksums were taken from");
+  }
+  if (header_ok) *header_ok = actual.header == expected.header;
+
+  IW_MRC_Header hdr = peekHeader(PositionalFile(path));
+  std::vector<DamagedSection> damaged;
+  size_t next_unreadable = 0;
+  for (size_t i = 0; i < actual.sections.size(); ++i) {
+    bool readable = true;
+    if (next_unreadable < unreadable.size() && unreadable[next_unreadable] == i) {
+      readable = false;
+      ++next_unreadable;
+    }
+    if (readable && actual.sections[i] == expected.sections[i]) continue;
+    DamagedSection d;
+    hdr.section_zwt(static_cast<int>(i), d.t, d.w, d.z);
+    d.expected = expected.sections[i];
+    d.actual = actual.sections[i];
+    d.readable = readable;
+    damaged.push_back(d);
+  }
+  return damaged;
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "dvfile.h"
+#include "dvparallel.h"
+
+struct CompareOptions {
+  // stop at the first section that differs and skip the statistics
+  bool exact = false;
+  unsigned threads = 0;  // section readers (0 = one per core)
+};
+
+// How one section of the test file differs from the reference.
+struct PlaneDiff {
+  int t, w, z;
+  bool equal;
+  double max_abs_diff;
+  double rmse;
+  double psnr;  // dB; infinite when equal
+};
+
+struct CompareResult {
+  bool same_shape = true;  // false if size, pixel type or dimensions differ
+  bool identical = true;
+  // every section in (t, w, z) order, or in exact mode only the first one found to differ
+  std::vector<PlaneDiff> planes;
+  double max_abs_diff = 0;
+  double rmse = 0;
+  double psnr = std::numeric_limits<double>::infinity();
+};
+
+namespace compare_detail {
+
+// PSNR in dB for a given peak signal and mean squared error.
+inline double psnr(double peak, double mse) {
+  if (mse == 0) return std::numeric_limits<double>::infinity();
+  if (peak == 0) return -std::numeric_limits<double>::infinity();
+  return 20 * std::log10(peak) - 10 * std::log10(mse);
+}
+
+// Peak signal used for PSNR: the type's maximum for integers, the reference's largest magnitude
+// for floating point.
+template <typename T>
+double peak(const T* reference, size_t n) {
+  if constexpr (std::is_floating_point<T>::value) {
+    return maxAbs(reference, n);
+  } else {
+    return static_cast<double>(std::numeric_limits<T>::max());
+  }
+}
+
+}  // namespace compare_detail
+
+/**
+ * @brief Compare `test` against `reference` section by section.
+ *
+ * Sections are matched by (t, w, z), so files with different interleaving compare equal if they
+ * hold the same data. Each worker reads its own run of sections with positional reads; equality
+ * is checked with memcmp before any statistics are computed. Complex data are compared
+ * component-wise. In exact mode the first difference stops the remaining workers, which is what
+ * regression tests against golden files want.
+ *
+ * @param reference The golden file; PSNR peaks come from its pixel type or data.
+ * @param test The file being checked.
+ */
+CompareResult compareDVFiles(const DVFile& reference, const DVFile& test,
+                             const CompareOptions& options = CompareOptions()) {
+  const IW_MRC_Header& rh = reference.header();
+  const IW_MRC_Header& th = test.header();
+  CompareResult result;
+  if (rh.nx != th.nx || rh.ny != th.ny || rh.nz != th.nz || rh.mode != th.mode ||
+      rh.num_waves != th.num_waves || rh.num_times != th.num_times) {
+    result.same_shape = false;
+    result.identical = false;
+    return result;
+  }
+
+  const size_t n = static_cast<size_t>(rh.nz);
+  const size_t frame = reference.frameSize();
+  const PixelType type = static_cast<PixelType>(rh.mode);
+  unsigned threads = options.threads ? options.threads : defaultThreadCount();
+  std::vector<std::vector<char>> buffers(threads * 2);
+  std::vector<PlaneDiff> planes(n);
+  std::vector<double> peaks(n, 0);
+  std::atomic<size_t> first_mismatch{n};
+
+  parallelForStealing(
+      n,
+      [&](size_t i, unsigned worker) {
+        if (options.exact && first_mismatch.load(std::memory_order_relaxed) < i) return;
+        std::vector<char>& a = buffers[2 * worker];
+        std::vector<char>& b = buffers[2 * worker + 1];
+        a.resize(frame);
+        b.resize(frame);
+        PlaneDiff& d = planes[i];
+        rh.section_zwt(static_cast<int>(i), d.t, d.w, d.z);
+        reference.readSecAt(a.data(), d.t, d.w, d.z);
+        test.readSecAt(b.data(), d.t, d.w, d.z);
+        d.equal = std::memcmp(a.data(), b.data(), frame) == 0;
+        d.max_abs_diff = 0;
+        d.rmse = 0;
+        d.psnr = std::numeric_limits<double>::infinity();
+        if (!d.equal) {
+          size_t seen = first_mismatch.load();
+          while (i < seen && !first_mismatch.compare_exchange_weak(seen, i)) {
+          }
+          if (options.exact) return;
+        }
+        visitPixelType(type, [&](auto tag) {
+          using T = typename decltype(tag)::type;
+          const size_t count = frame / sizeof(T);
+          const T* pa = reinterpret_cast<const T*>(a.data());
+          const T* pb = reinterpret_cast<const T*>(b.data());
+          peaks[i] = compare_detail::peak(pa, count);
+          if (d.equal) return;
+          double sum_sq;
+          diffStats(pa, pb, count, d.max_abs_diff, sum_sq);
+          d.rmse = std::sqrt(sum_sq / static_cast<double>(count));
+          d.psnr = compare_detail::psnr(peaks[i], sum_sq / static_cast<double>(count));
+        });
+      },
+      threads);
+
+  result.identical = first_mismatch.load() == n;
+  if (options.exact) {
+    if (!result.identical) result.planes.push_back(planes[first_mismatch.load()]);
+    return result;
+  }
+
+  // whole-file statistics, visited in (t, w, z) order
+  double sum_sq = 0;
+  double peak = 0;
+  const int nw = rh.num_waves ? rh.num_waves : 1;
+  const int nt = rh.num_times ? rh.num_times : 1;
+  for (int t = 0; t < nt; ++t) {
+    for (int w = 0; w < nw; ++w) {
+      for (int z = 0; z < rh.num_planes(); ++z) {
+        size_t i = static_cast<size_t>(rh.section_index(t, w, z));
+        result.planes.push_back(planes[i]);
+        result.max_abs_diff = std::max(result.max_abs_diff, planes[i].max_abs_diff);
+        sum_sq += planes[i].rmse * planes[i].rmse;
+        peak = std::max(peak, peaks[i]);
+      }
+    }
+  }
+  if (n > 0) {
+    result.rmse = std::sqrt(sum_sq / static_cast<double>(n));
+    result.psnr = compare_detail::psnr(peak, sum_sq / static_cast<double>(n));
+  }
+  return result;
+}
+
+CompareResult compareDVFiles(const std::string& reference, const std::string& test,
+                             const CompareOptions& options = CompareOptions()) {
+  return compareDVFiles(DVFile(reference), DVFile(test), options);
+}
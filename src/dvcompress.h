@@ -0,0 +1,486 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "dvfile.h"
+#include "dvparallel.h"
+
+// Chunked, compressed copy of a DV file with random access.
+//
+// Layout (native structs in the writing host's byte order, so files do not move between
+// little- and big-endian hosts):
+//   DVZHeader
+//   IW_MRC_Header of the source file, followed by its inbsym extended header bytes
+//   DVZChunk[num_chunks]  index, in (section in file order, tile row, tile column) order
+//   chunk data
+//
+// Each chunk is one tile (or one whole section) of pixels, filtered with a per-row delta and a
+// byte shuffle, then compressed with an LZ77 codec (dvlz) in the LZ4 block style. Chunks that do
+// not shrink are stored filtered but uncompressed (compressed_size == raw_size).
+
+namespace dvlz {
+
+const size_t kMinMatch = 4;
+const size_t kLastLiterals = 5;  // a block always ends with at least this many literals
+const size_t kMatchLimit = 12;   // no match starts within this many bytes of the end
+const int kHashBits = 14;
+
+inline uint32_t read32(const uint8_t* p) {
+  uint32_t v;
+  std::memcpy(&v, p, 4);
+  return v;
+}
+
+inline uint32_t hash(uint32_t v) { return (v * 2654435761u) >> (32 - kHashBits); }
+
+// Worst-case size of compress() output for n input bytes.
+size_t compressBound(size_t n) { return n + n / 255 + 16; }
+
+inline uint8_t* writeLength(uint8_t* op, size_t len) {
+  while (len >= 255) {
+    *op++ = 255;
+    len -= 255;
+  }
+  *op++ = static_cast<uint8_t>(len);
+  return op;
+}
+
+// Compress n bytes of src into dst (at least compressBound(n) bytes). Returns the output size.
+size_t compress(const uint8_t* src, size_t n, uint8_t* dst) {
+  uint8_t* op = dst;
+  size_t anchor = 0;
+  if (n > kMatchLimit) {
+    std::vector<uint32_t> table(size_t(1) << kHashBits, 0);
+    const size_t limit = n - kMatchLimit;
+    size_t ip = 1;
+    while (ip < limit) {
+      uint32_t seq = read32(src + ip);
+      uint32_t h = hash(seq);
+      size_t ref = table[h];
+      table[h] = static_cast<uint32_t>(ip);
+      if (ip - ref > 65535 || read32(src + ref) != seq) {
+        ip += 1 + ((ip - anchor) >> 6);  // skip faster through incompressible data
+        continue;
+      }
+      size_t len = kMinMatch;
+      while (ip + len < n - kLastLiterals && src[ref + len] == src[ip + len]) ++len;
+
+      size_t lit = ip - anchor;
+      uint8_t* token = op++;
+      size_t ml = len - kMinMatch;
+      *token = static_cast<uint8_t>(((lit < 15 ? lit : 15) << 4) | (ml < 15 ? ml : 15));
+      if (lit >= 15) op = writeLength(op, lit - 15);
+      std::memcpy(op, src + anchor, lit);
+      op += lit;
+      uint16_t offset = static_cast<uint16_t>(ip - ref);
+      *op++ = static_cast<uint8_t>(offset & 0xFF);
+      *op++ = static_cast<uint8_t>(offset >> 8);
+      if (ml >= 15) op = writeLength(op, ml - 15);
+      ip += len;
+      anchor = ip;
+    }
+  }
+  // trailing literals
+  size_t lit = n - anchor;
+  *op++ = static_cast<uint8_t>((lit < 15 ? lit : 15) << 4);
+  if (lit >= 15) op = writeLength(op, lit - 15);
+  if (lit > 0) std::memcpy(op, src + anchor, lit);
+  op += lit;
+  return op - dst;
+}
+
+// Decompress n bytes of src into exactly raw bytes of dst. Throws on malformed input.
+void decompress(const uint8_t* src, size_t n, uint8_t* dst, size_t raw) {
+  const uint8_t* ip = src;
+  const uint8_t* iend = src + n;
+  uint8_t* op = dst;
+  uint8_t* oend = dst + raw;
+  auto corrupt = [] { throw std::runtime_error("Corrupt compressed chunk"); };
+  auto readLength = [&](size_t len) {
+    uint8_t b;
+    do {
+      if (ip >= iend) corrupt();
+      b = *ip++;
+      len += b;
+    } while (b == 255);
+    return len;
+  };
+  while (true) {
+    if (ip >= iend) corrupt();
+    uint8_t token = *ip++;
+    size_t lit = token >> 4;
+    if (lit == 15) lit = readLength(lit);
+    if (static_cast<size_t>(iend - ip) < lit || static_cast<size_t>(oend - op) < lit) corrupt();
+    if (lit > 0) std::memcpy(op, ip, lit);
+    ip += lit;
+    op += lit;
+    if (ip == iend) break;
+
+    if (iend - ip < 2) corrupt();
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    size_t ml = token & 15;
+    if (ml == 15) ml = readLength(ml);
+    ml += kMinMatch;
+    if (offset == 0 || offset > static_cast<size_t>(op - dst) ||
+        static_cast<size_t>(oend - op) < ml) {
+      corrupt();
+    }
+    const uint8_t* match = op - offset;
+    if (offset >= ml) {
+      std::memcpy(op, match, ml);
+      op += ml;
+    } else {
+      for (size_t i = 0; i < ml; ++i) *op++ = *match++;
+    }
+  }
+  if (op != oend) corrupt();
+}
+
+}  // namespace dvlz
+
+struct DVZHeader {
+  char magic[8];  // "DVZCHUNK"
+  uint32_t version;
+  uint32_t flags;  // DVZ_* filter flags
+  uint32_t tile_x, tile_y;  // chunk shape in pixels (a whole section when equal to nx/ny)
+  uint64_t num_chunks;
+};
+
+struct DVZChunk {
+  uint64_t offset;  // from the start of the file
+  uint32_t compressed_size;
+  uint32_t raw_size;
+};
+
+const uint32_t DVZ_DELTA = 1;    // per-row difference of pixel values
+const uint32_t DVZ_SHUFFLE = 2;  // group the n-th bytes of all pixel values together
+
+// Filters and compresses chunks of pixels; the inverse of decodeChunk.
+class DVZCodec {
+ private:
+  size_t _elem;  // bytes per pixel value (per component for complex modes)
+  uint32_t _flags;
+
+  template <typename U>
+  static void deltaRows(uint8_t* data, size_t row_elems, size_t rows, bool forward) {
+    for (size_t r = 0; r < rows; ++r) {
+      U* row = reinterpret_cast<U*>(data) + r * row_elems;
+      if (forward) {
+        for (size_t i = row_elems; i-- > 1;) row[i] = static_cast<U>(row[i] - row[i - 1]);
+      } else {
+        for (size_t i = 1; i < row_elems; ++i) row[i] = static_cast<U>(row[i] + row[i - 1]);
+      }
+    }
+  }
+
+  void delta(uint8_t* data, size_t row_elems, size_t rows, bool forward) const {
+    switch (_elem) {
+      case 1: deltaRows<uint8_t>(data, row_elems, rows, forward); break;
+      case 2: deltaRows<uint16_t>(data, row_elems, rows, forward); break;
+      case 4: deltaRows<uint32_t>(data, row_elems, rows, forward); break;
+    }
+  }
+
+ public:
+  DVZCodec(size_t elem, uint32_t flags) : _elem(elem), _flags(flags) {}
+
+  // Encode `rows` rows of `row_elems` values each (data is modified in place by the filters).
+  // Returns the compressed bytes, or the filtered bytes if compression does not help.
+  std::vector<uint8_t> encode(std::vector<uint8_t>& data, size_t row_elems, size_t rows) const {
+    const size_t n = data.size();
+    if (_flags & DVZ_DELTA) delta(data.data(), row_elems, rows, true);
+    const std::vector<uint8_t>* filtered = &data;
+    std::vector<uint8_t> shuffled;
+    if ((_flags & DVZ_SHUFFLE) && _elem > 1) {
+      shuffled.resize(n);
+      const size_t count = n / _elem;
+      for (size_t i = 0; i < count; ++i) {
+        for (size_t b = 0; b < _elem; ++b) shuffled[b * count + i] = data[i * _elem + b];
+      }
+      filtered = &shuffled;
+    }
+    std::vector<uint8_t> out(dvlz::compressBound(n));
+    size_t size = dvlz::compress(filtered->data(), n, out.data());
+    if (size >= n) return *filtered;
+    out.resize(size);
+    return out;
+  }
+
+  // Decode a chunk into raw (raw_size bytes).
+  void decode(const uint8_t* chunk, size_t compressed_size, uint8_t* raw, size_t raw_size,
+              size_t row_elems, size_t rows) const {
+    const bool shuffle = (_flags & DVZ_SHUFFLE) && _elem > 1;
+    std::vector<uint8_t> tmp;
+    uint8_t* filtered = raw;
+    if (shuffle) {
+      tmp.resize(raw_size);
+      filtered = tmp.data();
+    }
+    if (compressed_size == raw_size) {
+      std::memcpy(filtered, chunk, raw_size);
+    } else {
+      dvlz::decompress(chunk, compressed_size, filtered, raw_size);
+    }
+    if (shuffle) {
+      const size_t count = raw_size / _elem;
+      for (size_t b = 0; b < _elem; ++b) {
+        const uint8_t* plane = filtered + b * count;
+        for (size_t i = 0; i < count; ++i) raw[i * _elem + b] = plane[i];
+      }
+    }
+    if (_flags & DVZ_DELTA) delta(raw, row_elems, rows, false);
+  }
+};
+
+// bytes per value that the delta/shuffle filters work on
+size_t dvzElementSize(PixelType type) {
+  size_t size = getPixelTypeSize(type);
+  return isComplex(type) ? size / 2 : size;
+}
+
+/**
+ * @brief Transcode a DV file into a chunked, compressed container.
+ *
+ * Sections are compressed in parallel in batches of a few sections per thread and written out in
+ * file order, so memory use stays at a few sections regardless of file size.
+ *
+ * @param path The DV file to read.
+ * @param out_path The container to write.
+ * @param tile_x Chunk width in pixels (0 = whole rows).
+ * @param tile_y Chunk height in pixels (0 = whole sections).
+ * @param flags Combination of DVZ_DELTA and DVZ_SHUFFLE.
+ * @param threads The number of worker threads (0 = one per core).
+ */
+void compressDVFile(const std::string& path, const std::string& out_path, int tile_x = 0,
+                    int tile_y = 0, uint32_t flags = DVZ_DELTA | DVZ_SHUFFLE,
+                    unsigned threads = 0) {
+  DVFile src(path);
+  const IW_MRC_Header hdr = src.getHeader();
+  const PixelType type = static_cast<PixelType>(hdr.mode);
+  if (getPixelTypeSize(type) == 0) {
+    throw std::runtime_error("Unsupported pixel mode: " + std::to_string(hdr.mode));
+  }
+  const std::vector<char> ext = src.readExtendedHeader();
+
+  DVZHeader zh = {};
+  std::memcpy(zh.magic, "DVZCHUNK", 8);
+  zh.version = 1;
+  zh.flags = flags;
+  zh.tile_x = tile_x > 0 ? std::min(tile_x, hdr.nx) : hdr.nx;
+  zh.tile_y = tile_y > 0 ? std::min(tile_y, hdr.ny) : hdr.ny;
+  const int tiles_x = (hdr.nx + zh.tile_x - 1) / zh.tile_x;
+  const int tiles_y = (hdr.ny + zh.tile_y - 1) / zh.tile_y;
+  const size_t tiles = static_cast<size_t>(tiles_x) * tiles_y;
+  const size_t sections = static_cast<size_t>(hdr.nz);
+  zh.num_chunks = sections * tiles;
+
+  PositionalFile out(out_path, true, true);
+  uint64_t offset = 0;
+  out.write(&zh, sizeof(zh), offset);
+  offset += sizeof(zh);
+  out.write(&hdr, sizeof(hdr), offset);
+  offset += sizeof(hdr);
+  out.write(ext.data(), ext.size(), offset);
+  offset += ext.size();
+  const uint64_t index_offset = offset;
+  std::vector<DVZChunk> index(zh.num_chunks);
+  offset += index.size() * sizeof(DVZChunk);
+
+  const size_t pixel = getPixelTypeSize(type);
+  const size_t elem = dvzElementSize(type);
+  const DVZCodec codec(elem, flags);
+  if (threads == 0) threads = defaultThreadCount();
+  const size_t batch = std::max<size_t>(1, threads * 2);
+  std::vector<std::vector<std::vector<uint8_t>>> encoded(batch);
+
+  for (size_t first = 0; first < sections; first += batch) {
+    size_t count = std::min(batch, sections - first);
+    parallelFor(
+        count,
+        [&](size_t i) {
+          size_t s = first + i;
+          std::vector<uint8_t> plane(src.frameSize());
+          src.readSecIndexAt(plane.data(), s);
+          encoded[i].assign(tiles, {});
+          for (int ty = 0; ty < tiles_y; ++ty) {
+            for (int tx = 0; tx < tiles_x; ++tx) {
+              int x0 = tx * zh.tile_x, y0 = ty * zh.tile_y;
+              int w = std::min<int>(zh.tile_x, hdr.nx - x0);
+              int h = std::min<int>(zh.tile_y, hdr.ny - y0);
+              std::vector<uint8_t> tile(static_cast<size_t>(w) * h * pixel);
+              for (int y = 0; y < h; ++y) {
+                std::memcpy(tile.data() + static_cast<size_t>(y) * w * pixel,
+                            plane.data() + (static_cast<size_t>(y0 + y) * hdr.nx + x0) * pixel,
+                            w * pixel);
+              }
+              encoded[i][ty * tiles_x + tx] = codec.encode(tile, w * pixel / elem, h);
+            }
+          }
+        },
+        threads);
+
+    // one large sequential write per batch
+    std::vector<uint8_t> run;
+    for (size_t i = 0; i < count; ++i) {
+      for (size_t c = 0; c < tiles; ++c) {
+        const std::vector<uint8_t>& chunk = encoded[i][c];
+        DVZChunk& entry = index[(first + i) * tiles + c];
+        int tx = static_cast<int>(c % tiles_x), ty = static_cast<int>(c / tiles_x);
+        size_t w = std::min<int>(zh.tile_x, hdr.nx - tx * zh.tile_x);
+        size_t h = std::min<int>(zh.tile_y, hdr.ny - ty * zh.tile_y);
+        entry.offset = offset + run.size();
+        entry.compressed_size = static_cast<uint32_t>(chunk.size());
+        entry.raw_size = static_cast<uint32_t>(w * h * pixel);
+        run.insert(run.end(), chunk.begin(), chunk.end());
+      }
+      encoded[i].clear();
+    }
+    out.write(run.data(), run.size(), offset);
+    offset += run.size();
+  }
+  out.write(index.data(), index.size() * sizeof(DVZChunk), index_offset);
+}
+
+// Reads a container written by compressDVFile with the same calls as DVFile. Tiles of a section
+// are decompressed in parallel.
+class DVCompressedFile {
+ private:
+  PositionalFile _file;
+  std::string _path;
+  DVZHeader _zh;
+  IW_MRC_Header hdr;
+  std::vector<char> _ext;
+  std::vector<DVZChunk> _index;
+  int _tiles_x = 1, _tiles_y = 1;
+  unsigned _nt = 1, _nw = 1, _np = 0;  // counts of 0 in the header mean one, as in DVFile
+  unsigned _threads;
+
+ public:
+  explicit DVCompressedFile(const std::string& path, unsigned threads = 0)
+      : _file(path), _path(path), _threads(threads) {
+    _file.read(&_zh, sizeof(_zh), 0);
+    if (std::memcmp(_zh.magic, "DVZCHUNK", 8) != 0 || _zh.version != 1) {
+      throw std::runtime_error(path + " is not a recognized compressed DV file.");
+    }
+    _file.read(&hdr, sizeof(hdr), sizeof(_zh));
+    // the sizes below come straight from disk; check them before dividing or allocating
+    const std::string problem = headerProblem(hdr, UINT64_MAX);
+    if (!problem.empty()) {
+      throw std::runtime_error(path + " has an invalid header: " + problem);
+    }
+    if (_zh.tile_x == 0 || _zh.tile_y == 0 || _zh.tile_x > static_cast<uint32_t>(hdr.nx) ||
+        _zh.tile_y > static_cast<uint32_t>(hdr.ny)) {
+      throw std::runtime_error(path + " has an invalid chunk shape.");
+    }
+    _ext.resize(hdr.inbsym > 0 ? hdr.inbsym : 0);
+    _file.read(_ext.data(), _ext.size(), sizeof(_zh) + sizeof(hdr));
+    _nt = static_cast<unsigned>(hdr.num_times ? hdr.num_times : 1);
+    _nw = static_cast<unsigned>(hdr.num_waves ? hdr.num_waves : 1);
+    _np = static_cast<unsigned>(hdr.num_planes());
+    _tiles_x = (hdr.nx + _zh.tile_x - 1) / _zh.tile_x;
+    _tiles_y = (hdr.ny + _zh.tile_y - 1) / _zh.tile_y;
+    if (_zh.num_chunks != static_cast<uint64_t>(hdr.nz) * _tiles_x * _tiles_y) {
+      throw std::runtime_error(path + " has an inconsistent chunk index.");
+    }
+    _index.resize(_zh.num_chunks);
+    const uint64_t index_offset = sizeof(_zh) + sizeof(hdr) + _ext.size();
+    _file.read(_index.data(), _index.size() * sizeof(DVZChunk), index_offset);
+
+    // every chunk must lie in the data area, in order within its section, and no larger than
+    // the codec can produce; readSecAt relies on all three
+    const uint64_t data_start = index_offset + _index.size() * sizeof(DVZChunk);
+    const uint64_t file_size = _file.size();
+    const size_t tiles = static_cast<size_t>(_tiles_x) * _tiles_y;
+    for (size_t i = 0; i < _index.size(); ++i) {
+      const DVZChunk& c = _index[i];
+      const uint64_t floor =
+          i % tiles == 0 ? data_start : _index[i - 1].offset + _index[i - 1].compressed_size;
+      if (c.offset < floor || c.compressed_size > dvlz::compressBound(c.raw_size) ||
+          c.compressed_size > file_size || c.offset > file_size - c.compressed_size) {
+        throw std::runtime_error("Corrupt chunk index in " + path);
+      }
+    }
+  }
+
+  IW_MRC_Header getHeader() const { return hdr; }
+
+  std::string getPath() const { return _path; }
+
+  const std::vector<char>& extendedHeader() const { return _ext; }
+
+  size_t getPixelSize() const { return getPixelTypeSize(static_cast<PixelType>(hdr.mode)); }
+
+  size_t frameSize() const { return static_cast<size_t>(hdr.nx) * hdr.ny * getPixelSize(); }
+
+  // uncompressed bytes / compressed bytes over all chunks
+  double compressionRatio() const {
+    uint64_t raw = 0, packed = 0;
+    for (const DVZChunk& c : _index) {
+      raw += c.raw_size;
+      packed += c.compressed_size;
+    }
+    return packed ? static_cast<double>(raw) / packed : 1.0;
+  }
+
+  // Read section (t, w, z). Safe to call from several threads.
+  void readSecAt(void* array, int t, int w, int z) const {
+    if (static_cast<unsigned>(t) >= _nt || static_cast<unsigned>(w) >= _nw ||
+        static_cast<unsigned>(z) >= _np) {
+      throw std::runtime_error("Section index out of range");
+    }
+    const PixelType type = static_cast<PixelType>(hdr.mode);
+    const size_t pixel = getPixelSize();
+    const size_t elem = dvzElementSize(type);
+    const DVZCodec codec(elem, _zh.flags);
+    const size_t tiles = static_cast<size_t>(_tiles_x) * _tiles_y;
+    const size_t first = static_cast<size_t>(hdr.section_index(t, w, z)) * tiles;
+    uint8_t* dst = reinterpret_cast<uint8_t*>(array);
+
+    // the chunks of one section are contiguous: fetch them with one read
+    const uint64_t begin = _index[first].offset;
+    const DVZChunk& last = _index[first + tiles - 1];
+    const uint64_t end = last.offset + last.compressed_size;
+    if (end < begin) {
+      throw std::runtime_error("Corrupt chunk index in " + _path);
+    }
+    std::vector<uint8_t> packed(end - begin);
+    _file.read(packed.data(), packed.size(), begin);
+
+    parallelFor(
+        tiles,
+        [&](size_t c) {
+          const DVZChunk& chunk = _index[first + c];
+          int tx = static_cast<int>(c % _tiles_x), ty = static_cast<int>(c / _tiles_x);
+          int x0 = tx * _zh.tile_x, y0 = ty * _zh.tile_y;
+          size_t w = std::min<int>(_zh.tile_x, hdr.nx - x0);
+          size_t h = std::min<int>(_zh.tile_y, hdr.ny - y0);
+          if (chunk.raw_size != w * h * pixel) {
+            throw std::runtime_error("Corrupt chunk index in " + _path);
+          }
+          if (chunk.offset < begin || chunk.offset + chunk.compressed_size > end) {
+            throw std::runtime_error("Corrupt chunk index in " + _path);
+          }
+          const uint8_t* src = packed.data() + (chunk.offset - begin);
+          if (_tiles_x == 1) {
+            // whole rows: decode straight into the destination
+            codec.decode(src, chunk.compressed_size, dst + y0 * w * pixel, chunk.raw_size,
+                         w * pixel / elem, h);
+            return;
+          }
+          std::vector<uint8_t> tile(chunk.raw_size);
+          codec.decode(src, chunk.compressed_size, tile.data(), tile.size(), w * pixel / elem, h);
+          for (size_t y = 0; y < h; ++y) {
+            std::memcpy(dst + ((y0 + y) * hdr.nx + x0) * pixel, tile.data() + y * w * pixel,
+                        w * pixel);
+          }
+        },
+        tiles > 1 ? _threads : 1);
+  }
+
+  void readSec(void* array, int t, int w, int z) { readSecAt(array, t, w, z); }
+};
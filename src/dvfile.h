@@ -1,6 +1,41 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "dvkernels.h"
+#include "dvparallel.h"
 
 enum class PixelType {
   UINT8 = 0,
@@ -13,13 +48,59 @@ enum class PixelType {
   INT32 = 7
 };
 
-std::unordered_map<PixelType, size_t> pixelTypeSizes = {
+const std::unordered_map<PixelType, size_t> pixelTypeSizes = {
     {PixelType::UINT8, sizeof(uint8_t)},       {PixelType::INT16, sizeof(int16_t)},
     {PixelType::FLOAT32, sizeof(float)},       {PixelType::COMPLEX_INT16, 2 * sizeof(int16_t)},
     {PixelType::COMPLEX64, 2 * sizeof(float)}, {PixelType::INT16_ALT, sizeof(int16_t)},
     {PixelType::UINT16, sizeof(uint16_t)},     {PixelType::INT32, sizeof(int32_t)}};
 
-size_t getPixelTypeSize(PixelType pixelType) { return pixelTypeSizes[pixelType]; }
+// Bytes per pixel, or 0 for a mode this library does not know.
+size_t getPixelTypeSize(PixelType pixelType) {
+  auto it = pixelTypeSizes.find(pixelType);
+  return it == pixelTypeSizes.end() ? 0 : it->second;
+}
+
+// How binned reads combine the pixels of a bin.
+enum class BinMode {
+  SUM,  // saturates at the range of the pixel type
+  MEAN  // rounded to nearest for integer types
+};
+
+bool isComplex(PixelType pixelType) {
+  return pixelType == PixelType::COMPLEX_INT16 || pixelType == PixelType::COMPLEX64;
+}
+
+// How DVFile expects its sections to be read; see DVFile::setAccessPattern.
+enum class AccessPattern { NORMAL, SEQUENTIAL, RANDOM, AUTO };
+
+// Orthogonal views through a Z stack: XZ takes one row of every plane, YZ one column.
+enum class OrthoAxis { XZ, YZ };
+
+// Planes that can be derived from complex section data.
+enum class ComplexPart { REAL, IMAG, MAGNITUDE, PHASE, POWER };
+
+template <typename T>
+struct PixelTag {
+  using type = T;
+};
+
+// Call f(PixelTag<T>{}) where T is the C++ type of one pixel value (one component for the
+// complex modes), e.g. visitPixelType(mode, [&](auto tag) { using T = typename
+// decltype(tag)::type; ... }).
+template <typename F>
+decltype(auto) visitPixelType(PixelType pixelType, F&& f) {
+  switch (pixelType) {
+    case PixelType::UINT8: return f(PixelTag<uint8_t>{});
+    case PixelType::INT16:
+    case PixelType::INT16_ALT:
+    case PixelType::COMPLEX_INT16: return f(PixelTag<int16_t>{});
+    case PixelType::FLOAT32:
+    case PixelType::COMPLEX64: return f(PixelTag<float>{});
+    case PixelType::UINT16: return f(PixelTag<uint16_t>{});
+    case PixelType::INT32: return f(PixelTag<int32_t>{});
+  }
+  throw std::runtime_error("Unknown pixel type: " + std::to_string(static_cast<int>(pixelType)));
+}
 
 typedef struct IW_MRC_Header {
   int32_t nx, ny, nz;        // nz : nplanes*nwave*ntime
@@ -58,6 +139,78 @@ typedef struct IW_MRC_Header {
 
   int num_planes() const { return nz / (num_waves ? num_waves : 1) / (num_times ? num_times : 1); }
 
+  // position of section (t, w, z) in the file, honoring the interleave
+  int section_index(int t, int w, int z) const {
+    int nw = num_waves ? num_waves : 1;
+    int nt = num_times ? num_times : 1;
+    int np = num_planes();
+    switch (interleaved) {
+      case 1: return (t * np + z) * nw + w;  // WZT
+      case 2: return (t * nw + w) * np + z;  // ZWT
+      default: return (w * nt + t) * np + z;  // ZTW
+    }
+  }
+
+  // inverse of section_index: the (t, w, z) stored at position `index` in the file
+  void section_zwt(int index, int& t, int& w, int& z) const {
+    int nw = num_waves ? num_waves : 1;
+    int nt = num_times ? num_times : 1;
+    int np = num_planes() ? num_planes() : 1;
+    switch (interleaved) {
+      case 1:  // WZT
+        w = index % nw;
+        z = index / nw % np;
+        t = index / nw / np;
+        break;
+      case 2:  // ZWT
+        z = index % np;
+        w = index / np % nw;
+        t = index / np / nw;
+        break;
+      default:  // ZTW
+        z = index % np;
+        t = index / np % nt;
+        w = index / np / nt;
+        break;
+    }
+  }
+
+  int num_resolutions() const { return nres > 1 ? nres : 1; }
+
+  // Header describing sub-resolution level `level` (0 = full resolution). Each level halves X and
+  // Y and divides the planes by nzfact (rounding up); waves, times and interleave are unchanged.
+  IW_MRC_Header level_header(int level) const {
+    if (level < 0 || level >= num_resolutions()) {
+      throw std::runtime_error("Resolution level out of range");
+    }
+    IW_MRC_Header lh = *this;
+    int zfact = nzfact > 1 ? nzfact : 1;
+    int planes = num_planes();
+    for (int r = 0; r < level; ++r) {
+      lh.nx = std::max(1, lh.nx / 2);
+      lh.ny = std::max(1, lh.ny / 2);
+      planes = (planes + zfact - 1) / zfact;
+      lh.xlen *= 2;
+      lh.ylen *= 2;
+      lh.zlen *= zfact;
+    }
+    lh.nz = planes * (num_waves ? num_waves : 1) * (num_times ? num_times : 1);
+    lh.nres = 1;
+    return lh;
+  }
+
+  // byte offset of the first section of sub-resolution level `level`; levels follow each other
+  // after the full resolution data
+  uint64_t level_offset(int level) const {
+    uint64_t offset = 1024 + static_cast<uint64_t>(inbsym);
+    size_t pixel = getPixelTypeSize(static_cast<PixelType>(mode));
+    for (int r = 0; r < level; ++r) {
+      IW_MRC_Header lh = level_header(r);
+      offset += static_cast<uint64_t>(lh.nx) * lh.ny * lh.nz * pixel;
+    }
+    return offset;
+  }
+
   std::string image_type() const {
     switch (file_type) {
       case 0:
@@ -91,33 +244,658 @@ typedef struct IW_MRC_Header {
 
 } IW_MRC_HEADER, *IW_MRC_HEADER_PTR;
 
+static_assert(sizeof(IW_MRC_Header) == 1024, "IW_MRC_Header must be exactly 1024 bytes");
+
+//////////////////////////////////////////////////////////////////////////////
+// Header layout
+//////////////////////////////////////////////////////////////////////////////
+
+enum class HeaderFieldType : uint8_t { CHAR, INT16, INT32, FLOAT32 };
+
+// One field of the 1024-byte header: where it lives and what it holds.
+struct HeaderField {
+  const char* name;
+  uint16_t offset;
+  HeaderFieldType type;
+  uint16_t count;
+
+  constexpr size_t element_size() const {
+    return type == HeaderFieldType::CHAR ? 1 : type == HeaderFieldType::INT16 ? 2 : 4;
+  }
+  constexpr size_t size() const { return element_size() * count; }
+};
+
+#define DV_HEADER_FIELD(field, type, count) \
+  HeaderField { #field, offsetof(IW_MRC_Header, field), HeaderFieldType::type, count }
+
+// The on-disk layout of IW_MRC_Header, in file order. Byte swapping for files of the other
+// endianness, header writing and HeaderView lookups all work from this one table.
+constexpr HeaderField kHeaderLayout[] = {
+    DV_HEADER_FIELD(nx, INT32, 1),          DV_HEADER_FIELD(ny, INT32, 1),
+    DV_HEADER_FIELD(nz, INT32, 1),          DV_HEADER_FIELD(mode, INT32, 1),
+    DV_HEADER_FIELD(nxst, INT32, 1),        DV_HEADER_FIELD(nyst, INT32, 1),
+    DV_HEADER_FIELD(nzst, INT32, 1),        DV_HEADER_FIELD(mx, INT32, 1),
+    DV_HEADER_FIELD(my, INT32, 1),          DV_HEADER_FIELD(mz, INT32, 1),
+    DV_HEADER_FIELD(xlen, FLOAT32, 1),      DV_HEADER_FIELD(ylen, FLOAT32, 1),
+    DV_HEADER_FIELD(zlen, FLOAT32, 1),      DV_HEADER_FIELD(alpha, FLOAT32, 1),
+    DV_HEADER_FIELD(beta, FLOAT32, 1),      DV_HEADER_FIELD(gamma, FLOAT32, 1),
+    DV_HEADER_FIELD(mapc, INT32, 1),        DV_HEADER_FIELD(mapr, INT32, 1),
+    DV_HEADER_FIELD(maps, INT32, 1),        DV_HEADER_FIELD(amin, FLOAT32, 1),
+    DV_HEADER_FIELD(amax, FLOAT32, 1),      DV_HEADER_FIELD(amean, FLOAT32, 1),
+    DV_HEADER_FIELD(ispg, INT32, 1),        DV_HEADER_FIELD(inbsym, INT32, 1),
+    DV_HEADER_FIELD(nDVID, INT16, 1),       DV_HEADER_FIELD(nblank, INT16, 1),
+    DV_HEADER_FIELD(ntst, INT32, 1),        DV_HEADER_FIELD(ibyte, CHAR, 24),
+    DV_HEADER_FIELD(nint, INT16, 1),        DV_HEADER_FIELD(nreal, INT16, 1),
+    DV_HEADER_FIELD(nres, INT16, 1),        DV_HEADER_FIELD(nzfact, INT16, 1),
+    DV_HEADER_FIELD(min2, FLOAT32, 1),      DV_HEADER_FIELD(max2, FLOAT32, 1),
+    DV_HEADER_FIELD(min3, FLOAT32, 1),      DV_HEADER_FIELD(max3, FLOAT32, 1),
+    DV_HEADER_FIELD(min4, FLOAT32, 1),      DV_HEADER_FIELD(max4, FLOAT32, 1),
+    DV_HEADER_FIELD(file_type, INT16, 1),   DV_HEADER_FIELD(lens, INT16, 1),
+    DV_HEADER_FIELD(n1, INT16, 1),          DV_HEADER_FIELD(n2, INT16, 1),
+    DV_HEADER_FIELD(v1, INT16, 1),          DV_HEADER_FIELD(v2, INT16, 1),
+    DV_HEADER_FIELD(min5, FLOAT32, 1),      DV_HEADER_FIELD(max5, FLOAT32, 1),
+    DV_HEADER_FIELD(num_times, INT16, 1),   DV_HEADER_FIELD(interleaved, INT16, 1),
+    DV_HEADER_FIELD(tilt_x, FLOAT32, 1),    DV_HEADER_FIELD(tilt_y, FLOAT32, 1),
+    DV_HEADER_FIELD(tilt_z, FLOAT32, 1),    DV_HEADER_FIELD(num_waves, INT16, 1),
+    DV_HEADER_FIELD(iwav1, INT16, 1),       DV_HEADER_FIELD(iwav2, INT16, 1),
+    DV_HEADER_FIELD(iwav3, INT16, 1),       DV_HEADER_FIELD(iwav4, INT16, 1),
+    DV_HEADER_FIELD(iwav5, INT16, 1),       DV_HEADER_FIELD(zorig, FLOAT32, 1),
+    DV_HEADER_FIELD(xorig, FLOAT32, 1),     DV_HEADER_FIELD(yorig, FLOAT32, 1),
+    DV_HEADER_FIELD(nlab, INT32, 1),        DV_HEADER_FIELD(label, CHAR, 800),
+};
+
+#undef DV_HEADER_FIELD
+
+// the fields must cover all 1024 bytes, in order, without gaps
+constexpr bool headerLayoutIsComplete() {
+  size_t position = 0;
+  for (const HeaderField& field : kHeaderLayout) {
+    if (field.offset != position) return false;
+    position += field.size();
+  }
+  return position == sizeof(IW_MRC_Header);
+}
+static_assert(headerLayoutIsComplete(), "kHeaderLayout does not match IW_MRC_Header");
+
+constexpr const HeaderField* findHeaderField(const char* name) {
+  for (const HeaderField& field : kHeaderLayout) {
+    const char* a = field.name;
+    const char* b = name;
+    while (*a && *a == *b) ++a, ++b;
+    if (*a == *b) return &field;
+  }
+  return nullptr;
+}
+
+bool hostIsBigEndian() {
+  const uint16_t probe = 1;
+  return *reinterpret_cast<const uint8_t*>(&probe) == 0;
+}
+
+// Reverse the bytes of each `element_size`-byte value in place.
+void swapBytes(void* data, size_t bytes, size_t element_size) {
+  uint8_t* p = static_cast<uint8_t*>(data);
+  if (element_size == 2) {
+    for (size_t i = 0; i + 1 < bytes; i += 2) std::swap(p[i], p[i + 1]);
+  } else if (element_size == 4) {
+    for (size_t i = 0; i + 3 < bytes; i += 4) {
+      std::swap(p[i], p[i + 3]);
+      std::swap(p[i + 1], p[i + 2]);
+    }
+  }
+}
+
+// Swap every multi-byte field of a raw header between little and big endian.
+void swapHeaderBytes(void* header) {
+  uint8_t* bytes = static_cast<uint8_t*>(header);
+  for (const HeaderField& field : kHeaderLayout) {
+    swapBytes(bytes + field.offset, field.size(), field.element_size());
+  }
+}
+
+// Header from 1024 raw bytes, swapping from the other byte order if `swapped`.
+IW_MRC_Header decodeHeader(const void* bytes, bool swapped) {
+  IW_MRC_Header hdr;
+  std::memcpy(&hdr, bytes, sizeof(IW_MRC_Header));
+  if (swapped) swapHeaderBytes(&hdr);
+  return hdr;
+}
+
+// 1024 raw bytes of `hdr` in the requested byte order.
+void encodeHeader(const IW_MRC_Header& hdr, bool big_endian, void* bytes) {
+  std::memcpy(bytes, &hdr, sizeof(IW_MRC_Header));
+  if (big_endian != hostIsBigEndian()) swapHeaderBytes(bytes);
+}
+
+/**
+ * Why `hdr` cannot describe the data of a DV file of `file_size` bytes, or an empty string if
+ * it can: the pixel mode must be known, the dimensions positive, nz a multiple of waves * times,
+ * and the header, extended header and nz sections must fit in the file. Sizes are compared in
+ * floating point first so absurd dimensions cannot overflow the exact check.
+ */
+std::string headerProblem(const IW_MRC_Header& hdr, uint64_t file_size) {
+  const size_t pixel = getPixelTypeSize(static_cast<PixelType>(hdr.mode));
+  if (pixel == 0) {
+    return "unsupported pixel mode " + std::to_string(hdr.mode);
+  }
+  if (hdr.nx <= 0 || hdr.ny <= 0 || hdr.nz < 0) {
+    return "invalid dimensions " + std::to_string(hdr.nx) + " x " + std::to_string(hdr.ny) +
+           " x " + std::to_string(hdr.nz);
+  }
+  if (hdr.num_waves < 0 || hdr.num_times < 0 || hdr.inbsym < 0) {
+    return "negative wavelength, time or extended header count";
+  }
+  if (hdr.interleaved < 0 || hdr.interleaved > 2) {
+    return "unknown interleave " + std::to_string(hdr.interleaved);
+  }
+  const int64_t stacks = static_cast<int64_t>(hdr.num_waves ? hdr.num_waves : 1) *
+                         (hdr.num_times ? hdr.num_times : 1);
+  if (hdr.nz % stacks != 0) {
+    return "nz " + std::to_string(hdr.nz) + " is not a multiple of waves * times";
+  }
+  const double approx = 1024.0 + hdr.inbsym + static_cast<double>(hdr.nx) * hdr.ny * pixel * hdr.nz;
+  if (approx > static_cast<double>(file_size) + 1.0) {
+    return "data runs past the end of the file";
+  }
+  const uint64_t expected = 1024 + static_cast<uint64_t>(hdr.inbsym) +
+                            static_cast<uint64_t>(hdr.nx) * hdr.ny * pixel * hdr.nz;
+  if (expected > file_size) {
+    return "data runs past the end of the file";
+  }
+  return "";
+}
+
+// Zero-copy, read-only view of a native-order header held elsewhere (a DVFile, a memory map, a
+// buffer read from disk). The storage must outlive the view.
+class HeaderView {
+ private:
+  const IW_MRC_Header* _hdr;
+
+ public:
+  explicit HeaderView(const IW_MRC_Header& hdr) : _hdr(&hdr) {}
+
+  // `bytes` must be 4-byte aligned and in native byte order
+  explicit HeaderView(const void* bytes) : _hdr(static_cast<const IW_MRC_Header*>(bytes)) {
+    if (reinterpret_cast<uintptr_t>(bytes) % alignof(IW_MRC_Header) != 0) {
+      throw std::runtime_error("HeaderView needs an aligned header buffer");
+    }
+  }
+
+  const IW_MRC_Header& operator*() const { return *_hdr; }
+  const IW_MRC_Header* operator->() const { return _hdr; }
+
+  // Element `i` of the named field converted to double, e.g. view.value("xlen").
+  double value(const char* name, size_t i = 0) const {
+    const HeaderField* field = findHeaderField(name);
+    if (field == nullptr || i >= field->count) {
+      throw std::runtime_error(std::string("Unknown header field: ") + name);
+    }
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(_hdr) + field->offset +
+                       i * field->element_size();
+    switch (field->type) {
+      case HeaderFieldType::CHAR: return static_cast<double>(*reinterpret_cast<const char*>(p));
+      case HeaderFieldType::INT16: return *reinterpret_cast<const int16_t*>(p);
+      case HeaderFieldType::INT32: return *reinterpret_cast<const int32_t*>(p);
+      case HeaderFieldType::FLOAT32: return *reinterpret_cast<const float*>(p);
+    }
+    return 0;
+  }
+};
+
+// Hints about how a byte range of a file is about to be used, passed to the kernel with
+// posix_fadvise (files) or madvise (maps). Platforms without them ignore the hints.
+enum class Advice {
+  NORMAL,      // default readahead
+  SEQUENTIAL,  // read in order: read ahead aggressively
+  RANDOM,      // scattered reads: do not read ahead
+  WILL_NEED,   // start reading the range in now
+  DONT_NEED    // the range has been consumed; drop it from the page cache
+};
+
+// Positional (offset-based) file access: pread/pwrite on POSIX, overlapped ReadFile/WriteFile on
+// Windows. Calls never touch a shared cursor, so several threads can use one instance at once.
+class PositionalFile {
+ private:
+#ifdef _WIN32
+  HANDLE _handle = INVALID_HANDLE_VALUE;
+#else
+  int _fd = -1;
+#endif
+  std::string _path;
+
+ public:
+  PositionalFile() = default;
+
+  PositionalFile(const std::string& path, bool writable = false, bool create = false) {
+    open(path, writable, create);
+  }
+
+  PositionalFile(const PositionalFile&) = delete;
+  PositionalFile& operator=(const PositionalFile&) = delete;
+
+  ~PositionalFile() { close(); }
+
+  void open(const std::string& path, bool writable = false, bool create = false) {
+    close();
+    _path = path;
+#ifdef _WIN32
+    DWORD access = GENERIC_READ | (writable ? GENERIC_WRITE : 0);
+    DWORD disposition = create ? CREATE_ALWAYS : OPEN_EXISTING;
+    _handle = CreateFileA(path.c_str(), access, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                          disposition, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (_handle == INVALID_HANDLE_VALUE) {
+      throw std::runtime_error("Failed to open file: " + path);
+    }
+#else
+    int flags = writable ? O_RDWR : O_RDONLY;
+    if (create) flags |= O_CREAT | O_TRUNC;
+    _fd = ::open(path.c_str(), flags, 0644);
+    if (_fd < 0) {
+      throw std::runtime_error("Failed to open file: " + path);
+    }
+#endif
+  }
+
+  void close() {
+#ifdef _WIN32
+    if (_handle != INVALID_HANDLE_VALUE) {
+      CloseHandle(_handle);
+      _handle = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (_fd >= 0) {
+      ::close(_fd);
+      _fd = -1;
+    }
+#endif
+  }
+
+  bool isOpen() const {
+#ifdef _WIN32
+    return _handle != INVALID_HANDLE_VALUE;
+#else
+    return _fd >= 0;
+#endif
+  }
+
+#ifndef _WIN32
+  int fd() const { return _fd; }
+#endif
+
+  void read(void* dst, size_t size, uint64_t offset) const {
+    char* p = reinterpret_cast<char*>(dst);
+    while (size > 0) {
+#ifdef _WIN32
+      OVERLAPPED ov = {};
+      ov.Offset = static_cast<DWORD>(offset);
+      ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+      DWORD chunk = static_cast<DWORD>(std::min<size_t>(size, 1u << 30));
+      DWORD n = 0;
+      if (!ReadFile(_handle, p, chunk, &n, &ov) && GetLastError() != ERROR_HANDLE_EOF) {
+        throw std::runtime_error("Failed to read from " + _path);
+      }
+#else
+      ssize_t n = ::pread(_fd, p, size, static_cast<off_t>(offset));
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        throw std::runtime_error("Failed to read from " + _path);
+      }
+#endif
+      if (n == 0) {
+        throw std::runtime_error("Unexpected end of file: " + _path);
+      }
+      p += n;
+      size -= n;
+      offset += n;
+    }
+  }
+
+  void write(const void* src, size_t size, uint64_t offset) const {
+    const char* p = reinterpret_cast<const char*>(src);
+    while (size > 0) {
+#ifdef _WIN32
+      OVERLAPPED ov = {};
+      ov.Offset = static_cast<DWORD>(offset);
+      ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+      DWORD chunk = static_cast<DWORD>(std::min<size_t>(size, 1u << 30));
+      DWORD n = 0;
+      if (!WriteFile(_handle, p, chunk, &n, &ov)) {
+        throw std::runtime_error("Failed to write to " + _path);
+      }
+#else
+      ssize_t n = ::pwrite(_fd, p, size, static_cast<off_t>(offset));
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        throw std::runtime_error("Failed to write to " + _path);
+      }
+#endif
+      p += n;
+      size -= n;
+      offset += n;
+    }
+  }
+
+  // Pass `advice` for `length` bytes at `offset` (0 = to the end of the file) to the kernel.
+  void advise(uint64_t offset, uint64_t length, Advice advice) const {
+#if defined(POSIX_FADV_SEQUENTIAL)
+    int flag = POSIX_FADV_NORMAL;
+    switch (advice) {
+      case Advice::NORMAL: flag = POSIX_FADV_NORMAL; break;
+      case Advice::SEQUENTIAL: flag = POSIX_FADV_SEQUENTIAL; break;
+      case Advice::RANDOM: flag = POSIX_FADV_RANDOM; break;
+      case Advice::WILL_NEED: flag = POSIX_FADV_WILLNEED; break;
+      case Advice::DONT_NEED: flag = POSIX_FADV_DONTNEED; break;
+    }
+    if (_fd >= 0) {
+      ::posix_fadvise(_fd, static_cast<off_t>(offset), static_cast<off_t>(length), flag);
+    }
+#else
+    (void)offset;
+    (void)length;
+    (void)advice;
+#endif
+  }
+
+  uint64_t size() const {
+#ifdef _WIN32
+    LARGE_INTEGER sz;
+    if (!GetFileSizeEx(_handle, &sz)) {
+      throw std::runtime_error("Failed to stat " + _path);
+    }
+    return static_cast<uint64_t>(sz.QuadPart);
+#else
+    struct stat st;
+    if (fstat(_fd, &st) != 0) {
+      throw std::runtime_error("Failed to stat " + _path);
+    }
+    return static_cast<uint64_t>(st.st_size);
+#endif
+  }
+};
+
+/**
+ * Read and decode the header at the start of `file` without checking it against the file's
+ * size, e.g. to inspect a damaged or truncated file. Throws if the DVID bytes are not
+ * recognized; `big_endian`, if given, receives the file's byte order.
+ */
+IW_MRC_Header peekHeader(const PositionalFile& file, bool* big_endian = nullptr) {
+  char raw[sizeof(IW_MRC_Header)];
+  file.read(raw, sizeof(raw), 0);
+  bool big;
+  if (raw[96] == (char)0xA0 && raw[97] == (char)0xC0) {
+    big = false;
+  } else if (raw[96] == (char)0xC0 && raw[97] == (char)0xA0) {
+    big = true;
+  } else {
+    throw std::runtime_error("Not a recognized DV file");
+  }
+  if (big_endian) *big_endian = big;
+  return decodeHeader(raw, big != hostIsBigEndian());
+}
+
+// Read-only memory map of a whole file (mmap on POSIX, a file mapping on Windows).
+class MappedFile {
+ private:
+  const uint8_t* _data = nullptr;
+  size_t _size = 0;
+#ifdef _WIN32
+  HANDLE _file = INVALID_HANDLE_VALUE;
+  HANDLE _mapping = nullptr;
+#endif
+
+ public:
+  // `hugepages` asks the kernel to back the map with transparent huge pages, cutting TLB misses
+  // on multi-GB scans; it is honored on Linux kernels with huge page support for file memory.
+  explicit MappedFile(const std::string& path, bool hugepages = false) {
+#ifdef _WIN32
+    (void)hugepages;  // large pages cannot back file mappings on Windows
+    _file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                        FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (_file == INVALID_HANDLE_VALUE) {
+      throw std::runtime_error("Failed to open file: " + path);
+    }
+    LARGE_INTEGER sz;
+    GetFileSizeEx(_file, &sz);
+    _size = static_cast<size_t>(sz.QuadPart);
+    if (_size > 0) {
+      _mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+      if (_mapping == nullptr) {
+        CloseHandle(_file);
+        throw std::runtime_error("Failed to map file: " + path);
+      }
+      _data = static_cast<const uint8_t*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+    }
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("Failed to open file: " + path);
+    }
+    struct stat st;
+    fstat(fd, &st);
+    _size = static_cast<size_t>(st.st_size);
+    if (_size > 0) {
+      void* p = mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+      _data = p == MAP_FAILED ? nullptr : static_cast<const uint8_t*>(p);
+    }
+    ::close(fd);  // the mapping keeps its own reference to the file
+#ifdef MADV_HUGEPAGE
+    if (hugepages && _data) ::madvise(const_cast<uint8_t*>(_data), _size, MADV_HUGEPAGE);
+#endif
+#endif
+    if (_size > 0 && _data == nullptr) {
+      throw std::runtime_error("Failed to map file: " + path);
+    }
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  ~MappedFile() {
+#ifdef _WIN32
+    if (_data) UnmapViewOfFile(_data);
+    if (_mapping) CloseHandle(_mapping);
+    if (_file != INVALID_HANDLE_VALUE) CloseHandle(_file);
+#else
+    if (_data) munmap(const_cast<uint8_t*>(_data), _size);
+#endif
+  }
+
+  const uint8_t* data() const { return _data; }
+
+  size_t size() const { return _size; }
+
+  // Pass `advice` for `length` bytes of the map at `offset` to the kernel; the range is widened
+  // to whole pages.
+  void advise(uint64_t offset, uint64_t length, Advice advice) const {
+#ifndef _WIN32
+    if (_data == nullptr || offset >= _size) return;
+    length = std::min<uint64_t>(length ? length : _size, _size - offset);
+    const uint64_t page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    const uint64_t start = offset / page * page;
+    int flag = MADV_NORMAL;
+    switch (advice) {
+      case Advice::NORMAL: flag = MADV_NORMAL; break;
+      case Advice::SEQUENTIAL: flag = MADV_SEQUENTIAL; break;
+      case Advice::RANDOM: flag = MADV_RANDOM; break;
+      case Advice::WILL_NEED: flag = MADV_WILLNEED; break;
+      case Advice::DONT_NEED: flag = MADV_DONTNEED; break;
+    }
+    ::madvise(const_cast<uint8_t*>(_data) + start, offset + length - start, flag);
+#else
+    (void)offset;
+    (void)length;
+    (void)advice;
+#endif
+  }
+};
+
+// Per-wavelength dark frames and reciprocal flat fields for DVFile::readSecCorrected, which
+// computes (raw - dark) * inv_flat. Holding a single frame applies it to every wavelength.
+struct FlatField {
+  int nx = 0;
+  int ny = 0;
+  std::vector<std::vector<float>> dark;      // nx * ny values per wavelength
+  std::vector<std::vector<float>> inv_flat;  // nx * ny values per wavelength
+
+  int num_waves() const { return static_cast<int>(dark.size()); }
+  const float* darkFor(int w) const { return dark[dark.size() == 1 ? 0 : w].data(); }
+  const float* invFlatFor(int w) const { return inv_flat[inv_flat.size() == 1 ? 0 : w].data(); }
+};
+
 class DVFile {
  private:
   std::unique_ptr<std::ifstream> _file;
+  std::unique_ptr<PositionalFile> _pfile;  // for cursor-free reads from any thread
   std::string _path;
   bool _big_endian;
+  bool _swapped;  // file byte order differs from the host's
   IW_MRC_Header hdr;
+  std::shared_ptr<const FlatField> _flat_field;
   bool closed = true;
+  AccessPattern _pattern = AccessPattern::NORMAL;
+  Advice _auto_advice = Advice::NORMAL;  // what AUTO last told the kernel
+  int _recent[4] = {-1, -1, -1, -1};     // section indices of recent setCurrentZWT calls
+  int _recent_count = 0;
+  mutable std::mutex _map_mutex;
+  mutable std::unique_ptr<MappedFile> _map;  // created by the first YZ slice
+  bool _hugepages = false;                    // back _map with transparent huge pages
+
+  const MappedFile& _mapped() const {
+    std::lock_guard<std::mutex> lock(_map_mutex);
+    if (!_map) _map = std::make_unique<MappedFile>(_path, _hugepages);
+    return *_map;
+  }
+
+  template <typename U>
+  void _readCorrected(U* out, int t, int w, int z) const {
+    if (closed) {
+      throw std::runtime_error("Cannot read from closed file. Please reopen with .open()");
+    }
+    if (!_flat_field) {
+      throw std::runtime_error("No flat field set");
+    }
+    _validateZWT(z, w, t);
+    PixelType type = static_cast<PixelType>(hdr.mode);
+    if (isComplex(type)) {
+      throw std::runtime_error("Flat-field correction is not supported for complex data");
+    }
+    const float* dark = _flat_field->darkFor(w);
+    const float* inv_flat = _flat_field->invFlatFor(w);
+    visitPixelType(type, [&](auto tag) {
+      using T = typename decltype(tag)::type;
+      _forEachBand<T>(t, w, z, [&](const T* band, size_t first, size_t pixels) {
+        correctFlatDark(band, dark + first, inv_flat + first, pixels, out + first);
+      });
+    });
+  }
+
+  // Read section (t, w, z) in row bands of about 64 KB, which stay in cache between the read and
+  // the kernel, calling fn(band, first_pixel, pixels) for each. T is the type of one pixel value
+  // (one component for the complex modes).
+  template <typename T, typename F>
+  void _forEachBand(int t, int w, int z, F&& fn) const {
+    const size_t row_bytes = static_cast<size_t>(hdr.nx) * getPixelSize();
+    const int band_rows = std::max<int>(1, std::min<int>(hdr.ny, (64 << 10) / row_bytes));
+    std::vector<T> band(static_cast<size_t>(band_rows) * row_bytes / sizeof(T));
+    const uint64_t base = sectionOffset(t, w, z);
+    for (int y = 0; y < hdr.ny; y += band_rows) {
+      const int rows = std::min(band_rows, hdr.ny - y);
+      _pfile->read(band.data(), rows * row_bytes, base + y * row_bytes);
+      _toHostOrder(band.data(), rows * row_bytes);
+      fn(static_cast<const T*>(band.data()), static_cast<size_t>(y) * hdr.nx,
+         static_cast<size_t>(rows) * hdr.nx);
+    }
+  }
 
-  void _validateZWT(int z, int w, int t) {
-    if (t >= hdr.num_times) {
+  template <typename F>
+  void _readComplex(int t, int w, int z, F&& fn) const {
+    if (closed) {
+      throw std::runtime_error("Cannot read from closed file. Please reopen with .open()");
+    }
+    _validateZWT(z, w, t);
+    PixelType type = static_cast<PixelType>(hdr.mode);
+    if (!isComplex(type)) {
+      throw std::runtime_error("Section data are not complex");
+    }
+    visitPixelType(type, [&](auto tag) {
+      using T = typename decltype(tag)::type;
+      _forEachBand<T>(t, w, z, [&](const T* band, size_t first, size_t pixels) {
+        fn(band, first, pixels);
+      });
+    });
+  }
+
+  // Whole-file advice for the section data, mirrored onto the map if there is one.
+  void _adviseData(Advice advice) const {
+    const uint64_t length = static_cast<uint64_t>(hdr.nz) * frameSize();
+    _pfile->advise(dataOffset(), length, advice);
+    std::lock_guard<std::mutex> lock(_map_mutex);
+    if (_map) _map->advise(dataOffset(), length, advice);
+  }
+
+  // AUTO mode: classify the last few sections visited and advise accordingly. A stride of one
+  // section is a sequential scan; any other constant stride gets random-access advice plus a
+  // prefetch of the next two sections along the stride; anything else is random.
+  void _trackAccess(int index) {
+    for (int i = 3; i > 0; --i) _recent[i] = _recent[i - 1];
+    _recent[0] = index;
+    if (++_recent_count < 4) return;
+    const int stride = _recent[0] - _recent[1];
+    const bool constant = stride != 0 && _recent[1] - _recent[2] == stride &&
+                          _recent[2] - _recent[3] == stride;
+    const Advice advice = constant && stride == 1 ? Advice::SEQUENTIAL : Advice::RANDOM;
+    if (advice != _auto_advice) {
+      _adviseData(advice);
+      _auto_advice = advice;
+    }
+    if (constant && stride != 1) {
+      for (int k = 1; k <= 2; ++k) {
+        const int next = index + k * stride;
+        if (next < 0 || next >= hdr.nz) break;
+        _pfile->advise(dataOffset() + static_cast<uint64_t>(next) * frameSize(), frameSize(),
+                       Advice::WILL_NEED);
+      }
+    }
+  }
+
+  void _toHostOrder(void* array, size_t bytes) const {
+    if (_swapped) {
+      PixelType type = static_cast<PixelType>(hdr.mode);
+      swapBytes(array, bytes, isComplex(type) ? getPixelSize() / 2 : getPixelSize());
+    }
+  }
+
+  // Dimensions cached once the header has been validated at open. Any (t, w, z) within them
+  // maps to a section inside the file, so one unsigned compare per axis is the only check the
+  // read paths need.
+  unsigned _nt = 1, _nw = 1, _np = 0;
+
+  void _validateZWT(int z, int w, int t) const {
+    if (static_cast<unsigned>(t) >= _nt) {
       throw std::runtime_error("Time index out of range");
     }
-    if (w >= hdr.num_waves) {
+    if (static_cast<unsigned>(w) >= _nw) {
       throw std::runtime_error("Wavelength index out of range");
     }
-    if (z >= hdr.num_planes()) {
+    if (static_cast<unsigned>(z) >= _np) {
       throw std::runtime_error("Section index out of range");
     }
   }
 
  public:
-  DVFile(const std::string& path) {
+  // `hugepages` backs the memory map used by whole-volume reads such as readOrthoSlice with
+  // transparent huge pages (see MappedFile); stream and positional reads are unaffected.
+  DVFile(const std::string& path, bool hugepages = false) : _hugepages(hugepages) {
     _path = path;
     _file = std::make_unique<std::ifstream>(path, std::ios::binary);
     if (!_file->is_open()) {
       throw std::runtime_error("Failed to open file");
     }
+    _pfile = std::make_unique<PositionalFile>(path);
+    const uint64_t file_size = _pfile->size();
+    if (file_size < sizeof(IW_MRC_Header)) {
+      throw std::runtime_error(path + " is too short to be a DV file.");
+    }
 
     // Determine byte order
     _file->seekg(24 * 4);
@@ -132,18 +910,31 @@ class DVFile {
     }
 
     // Read header
+    char raw[sizeof(IW_MRC_Header)];
     _file->seekg(0);
-    _file->read(reinterpret_cast<char*>(&hdr), sizeof(IW_MRC_Header));
+    _file->read(raw, sizeof(IW_MRC_Header));
+    _swapped = _big_endian != hostIsBigEndian();
+    hdr = decodeHeader(raw, _swapped);
+
+    // reject inconsistent headers before anything is sized from them
+    std::string problem = headerProblem(hdr, file_size);
+    if (!problem.empty()) {
+      throw std::runtime_error(path + " has an invalid header: " + problem);
+    }
+    _nt = static_cast<unsigned>(hdr.num_times ? hdr.num_times : 1);
+    _nw = static_cast<unsigned>(hdr.num_waves ? hdr.num_waves : 1);
+    _np = static_cast<unsigned>(hdr.num_planes());
     closed = false;
   }
 
   // this is only here for the IVE API
   void setCurrentZWT(int z, int w, int t) {
     _validateZWT(z, w, t);
+    if (_pattern == AccessPattern::AUTO) _trackAccess(hdr.section_index(t, w, z));
 
     size_t frame_size = hdr.ny * hdr.nx * getPixelSize();
     int header_size = 1024 + hdr.inbsym;
-    int section_offset = (t * hdr.num_waves * hdr.num_planes() + w * hdr.num_planes() + z);
+    size_t section_offset = hdr.section_index(t, w, z);
     _file->seekg(header_size + section_offset * frame_size);
   }
 
@@ -153,6 +944,7 @@ class DVFile {
     }
     size_t frame_size = hdr.ny * hdr.nx * getPixelSize();
     _file->read(reinterpret_cast<char*>(array), frame_size);
+    _toHostOrder(array, frame_size);
   }
 
   void readSec(void* array, int t, int w, int z) {
@@ -160,7 +952,367 @@ class DVFile {
     readSec(array);
   }
 
-  size_t getPixelSize() { return getPixelTypeSize(static_cast<PixelType>(hdr.mode)); }
+  // Read section (t, w, z) without moving the read cursor. Safe to call from several threads.
+  void readSecAt(void* array, int t, int w, int z) const {
+    if (closed) {
+      throw std::runtime_error("Cannot read from closed file. Please reopen with .open()");
+    }
+    _validateZWT(z, w, t);
+    _pfile->read(array, frameSize(), sectionOffset(t, w, z));
+    _toHostOrder(array, frameSize());
+  }
+
+  // Read section (t, w, z) of sub-resolution level `level` (0 = full resolution).
+  void readSecAt(void* array, int t, int w, int z, int level) const {
+    if (level == 0) {
+      readSecAt(array, t, w, z);
+      return;
+    }
+    if (closed) {
+      throw std::runtime_error("Cannot read from closed file. Please reopen with .open()");
+    }
+    IW_MRC_Header lh = hdr.level_header(level);
+    _validateZWT(0, w, t);
+    if (z < 0 || z >= lh.num_planes()) {
+      throw std::runtime_error("Section index out of range");
+    }
+    size_t frame = static_cast<size_t>(lh.nx) * lh.ny * getPixelSize();
+    _pfile->read(array, frame, hdr.level_offset(level) + lh.section_index(t, w, z) * frame);
+    _toHostOrder(array, frame);
+  }
+
+  // Read the section at position `index` in file order. Safe to call from several threads.
+  void readSecIndexAt(void* array, size_t index) const {
+    if (closed) {
+      throw std::runtime_error("Cannot read from closed file. Please reopen with .open()");
+    }
+    if (index >= static_cast<size_t>(hdr.nz)) {
+      throw std::runtime_error("Section index out of range");
+    }
+    _pfile->read(array, frameSize(), dataOffset() + index * frameSize());
+    _toHostOrder(array, frameSize());
+  }
+
+  // Read `count` consecutive sections starting at `first` in file order with one positional
+  // read. Safe to call from several threads.
+  void readSectionsAt(void* array, size_t first, size_t count) const {
+    if (closed) {
+      throw std::runtime_error("Cannot read from closed file. Please reopen with .open()");
+    }
+    if (first + count > static_cast<size_t>(hdr.nz) || first + count < first) {
+      throw std::runtime_error("Section index out of range");
+    }
+    _pfile->read(array, count * frameSize(), dataOffset() + first * frameSize());
+    _toHostOrder(array, count * frameSize());
+  }
+
+  // the inbsym bytes of extended header that follow the main header
+  std::vector<char> readExtendedHeader() const {
+    if (closed) {
+      throw std::runtime_error("Cannot read from closed file. Please reopen with .open()");
+    }
+    std::vector<char> ext(hdr.inbsym > 0 ? hdr.inbsym : 0);
+    _pfile->read(ext.data(), ext.size(), 1024);
+    return ext;
+  }
+
+  // True if the extended header holds a record of nint ints and nreal floats for every section.
+  bool hasSectionRecords() const {
+    const uint64_t record = 4 * static_cast<uint64_t>(std::max(0, hdr.nint + hdr.nreal));
+    return record > 0 && hdr.nz > 0 && record * hdr.nz <= static_cast<uint64_t>(hdr.inbsym);
+  }
+
+  /**
+   * Read the extended header record of section (t, w, z) in host byte order: nint values into
+   * `ints` and nreal values into `floats` (either may be null). For DV files the floats start
+   * with photosensor reading, elapsed time and stage X, Y, Z.
+   */
+  void readSectionRecord(int t, int w, int z, int32_t* ints, float* floats) const {
+    if (closed) {
+      throw std::runtime_error("Cannot read from closed file. Please reopen with .open()");
+    }
+    _validateZWT(z, w, t);
+    if (!hasSectionRecords()) {
+      throw std::runtime_error("Extended header has no per-section records");
+    }
+    const size_t count = static_cast<size_t>(hdr.nint + hdr.nreal);
+    std::vector<uint8_t> record(4 * count);
+    _pfile->read(record.data(), record.size(),
+                 1024 + static_cast<uint64_t>(hdr.section_index(t, w, z)) * record.size());
+    if (_swapped) swapBytes(record.data(), record.size(), 4);
+    if (ints) std::memcpy(ints, record.data(), 4 * static_cast<size_t>(hdr.nint));
+    if (floats) {
+      std::memcpy(floats, record.data() + 4 * hdr.nint, 4 * static_cast<size_t>(hdr.nreal));
+    }
+  }
+
+  // byte offset of the first section
+  uint64_t dataOffset() const { return 1024 + static_cast<uint64_t>(hdr.inbsym); }
+
+  // bytes per full-resolution section
+  size_t frameSize() const {
+    return static_cast<size_t>(hdr.nx) * hdr.ny * getPixelSize();
+  }
+
+  uint64_t sectionOffset(int t, int w, int z) const {
+    return dataOffset() + static_cast<uint64_t>(hdr.section_index(t, w, z)) * frameSize();
+  }
+
+  // number of resolution levels stored in the file, including full resolution
+  int numResolutions() const { return hdr.num_resolutions(); }
+
+  IW_MRC_Header levelHeader(int level) const { return hdr.level_header(level); }
+
+  uint64_t levelOffset(int level) const { return hdr.level_offset(level); }
+
+  // Header describing the data as returned by readSecBinned.
+  IW_MRC_Header binnedHeader(int bin, int zbin = 1) const {
+    if (bin < 1 || zbin < 1) {
+      throw std::runtime_error("Bin factors must be at least 1");
+    }
+    IW_MRC_Header bh = hdr;
+    bh.nx = hdr.nx / bin;
+    bh.ny = hdr.ny / bin;
+    bh.xlen *= bin;
+    bh.ylen *= bin;
+    bh.zlen *= zbin;
+    bh.nz = hdr.num_planes() / zbin * (hdr.num_waves ? hdr.num_waves : 1) *
+            (hdr.num_times ? hdr.num_times : 1);
+    bh.nres = 1;
+    return bh;
+  }
+
+  /**
+   * Read section (t, w, z) of the binned data: bin x bin blocks in XY, and zbin consecutive
+   * planes in Z (z indexes binned planes). Output pixels have the file's pixel type and
+   * binnedHeader(bin, zbin) gives the output shape; partial bins at the edges are dropped.
+   * Sources are read in row bands and accumulated in a wide type, so no full-resolution plane is
+   * ever held in memory. Safe to call from several threads.
+   */
+  void readSecBinned(void* array, int t, int w, int z, int bin, int zbin = 1,
+                     BinMode mode = BinMode::MEAN) const {
+    if (closed) {
+      throw std::runtime_error("Cannot read from closed file. Please reopen with .open()");
+    }
+    IW_MRC_Header bh = binnedHeader(bin, zbin);
+    _validateZWT(0, w, t);
+    if (z < 0 || z >= bh.num_planes()) {
+      throw std::runtime_error("Section index out of range");
+    }
+    PixelType type = static_cast<PixelType>(hdr.mode);
+    if (isComplex(type)) {
+      throw std::runtime_error("Binning is not supported for complex data");
+    }
+    const size_t out_pixels = static_cast<size_t>(bh.nx) * bh.ny;
+    if (out_pixels == 0) return;
+
+    visitPixelType(type, [&](auto tag) {
+      using T = typename decltype(tag)::type;
+      using A = accumulator_t<T>;
+      std::vector<A> acc(out_pixels, 0);
+      // read about 1 MB of whole bins per request
+      const size_t row_bytes = static_cast<size_t>(hdr.nx) * sizeof(T);
+      const int bands = std::max<int>(1, static_cast<int>((1 << 20) / (row_bytes * bin)));
+      const int band_rows = std::min(bands, bh.ny) * bin;
+      std::vector<T> band(static_cast<size_t>(band_rows) * hdr.nx);
+      for (int zs = z * zbin; zs < (z + 1) * zbin; ++zs) {
+        uint64_t base = sectionOffset(t, w, zs);
+        for (int y = 0; y < bh.ny * bin; y += band_rows) {
+          int rows = std::min(band_rows, bh.ny * bin - y);
+          _pfile->read(band.data(), rows * row_bytes, base + y * row_bytes);
+          _toHostOrder(band.data(), rows * row_bytes);
+          accumulateBlocks(band.data(), hdr.nx, rows, bin, bin,
+                           acc.data() + static_cast<size_t>(y / bin) * bh.nx);
+        }
+      }
+      T* out = reinterpret_cast<T*>(array);
+      if (mode == BinMode::SUM) {
+        storeSum(acc.data(), out_pixels, out);
+      } else {
+        storeMean(acc.data(), out_pixels, static_cast<A>(bin * bin * zbin), out);
+      }
+    });
+  }
+
+  // Use `flat_field` for readSecCorrected, or stop correcting if it is null. Not safe to call
+  // while other threads are reading.
+  void setFlatField(std::shared_ptr<const FlatField> flat_field) {
+    if (flat_field) {
+      const int nw = hdr.num_waves ? hdr.num_waves : 1;
+      if (flat_field->nx != hdr.nx || flat_field->ny != hdr.ny) {
+        throw std::runtime_error("Flat field size does not match the image");
+      }
+      if (flat_field->num_waves() != 1 && flat_field->num_waves() != nw) {
+        throw std::runtime_error("Flat field has the wrong number of wavelengths");
+      }
+    }
+    _flat_field = std::move(flat_field);
+  }
+
+  const FlatField* flatField() const { return _flat_field.get(); }
+
+  /**
+   * Read section (t, w, z) with dark subtraction and flat-field division applied, as floats.
+   * The raw data is read in small row bands and corrected straight into `array`, so no
+   * intermediate plane is needed. Safe to call from several threads.
+   */
+  void readSecCorrected(float* array, int t, int w, int z) const {
+    _readCorrected(array, t, w, z);
+  }
+
+  // As above, but the output has the file's pixel type, rounded and saturated.
+  void readSecCorrected(void* array, int t, int w, int z) const {
+    visitPixelType(static_cast<PixelType>(hdr.mode), [&](auto tag) {
+      using T = typename decltype(tag)::type;
+      _readCorrected(reinterpret_cast<T*>(array), t, w, z);
+    });
+  }
+
+  /**
+   * Read one derived plane of complex section (t, w, z) as floats, e.g. the magnitude of an OTF,
+   * without first deinterleaving the (real, imag) pairs. Safe to call from several threads.
+   */
+  void readSecComplex(float* array, int t, int w, int z, ComplexPart part) const {
+    _readComplex(t, w, z, [&](const auto* band, size_t first, size_t pixels) {
+      float* out = array + first;
+      switch (part) {
+        case ComplexPart::REAL: complexComponent(band, pixels, 0, out); break;
+        case ComplexPart::IMAG: complexComponent(band, pixels, 1, out); break;
+        case ComplexPart::MAGNITUDE: complexMagnitude(band, pixels, out); break;
+        case ComplexPart::PHASE: complexPhase(band, pixels, out); break;
+        case ComplexPart::POWER: complexPower(band, pixels, out); break;
+      }
+    });
+  }
+
+  // Split complex section (t, w, z) into separate real and imaginary planes of the component
+  // type (int16_t for COMPLEX_INT16, float for COMPLEX64).
+  void readSecSplit(void* real, void* imag, int t, int w, int z) const {
+    _readComplex(t, w, z, [&](const auto* band, size_t first, size_t pixels) {
+      using T = std::remove_const_t<std::remove_pointer_t<decltype(band)>>;
+      splitComplex(band, pixels, static_cast<T*>(real) + first, static_cast<T*>(imag) + first);
+    });
+  }
+
+  /**
+   * Read the width x height region at (x, y) of section (t, w, z) into `array`, row by row. A
+   * region spanning whole rows is one positional read, otherwise each row is one. Safe to call
+   * from several threads.
+   */
+  void readRegion(void* array, int t, int w, int z, int x, int y, int width, int height) const {
+    if (closed) {
+      throw std::runtime_error("Cannot read from closed file. Please reopen with .open()");
+    }
+    _validateZWT(z, w, t);
+    if (x < 0 || y < 0 || width < 0 || height < 0 || x + width > hdr.nx || y + height > hdr.ny) {
+      throw std::runtime_error("Region out of range");
+    }
+    const size_t pixel = getPixelSize();
+    const size_t row_bytes = static_cast<size_t>(width) * pixel;
+    const uint64_t base = sectionOffset(t, w, z) + (static_cast<uint64_t>(y) * hdr.nx + x) * pixel;
+    uint8_t* out = static_cast<uint8_t*>(array);
+    if (width == hdr.nx) {
+      _pfile->read(out, row_bytes * height, base);
+    } else {
+      const uint64_t stride = static_cast<uint64_t>(hdr.nx) * pixel;
+      for (int r = 0; r < height; ++r) {
+        _pfile->read(out + r * row_bytes, row_bytes, base + r * stride);
+      }
+    }
+    _toHostOrder(array, row_bytes * height);
+  }
+
+  /**
+   * Tell the kernel how the section data will be read. SEQUENTIAL and RANDOM tune readahead for
+   * the whole file; AUTO watches the sections visited through setCurrentZWT / readSec(t, w, z)
+   * and switches between the two, prefetching ahead of constant-stride scrubbing.
+   */
+  void setAccessPattern(AccessPattern pattern) {
+    _pattern = pattern;
+    _recent_count = 0;
+    std::fill(std::begin(_recent), std::end(_recent), -1);
+    switch (pattern) {
+      case AccessPattern::NORMAL: _adviseData(Advice::NORMAL); break;
+      case AccessPattern::SEQUENTIAL: _adviseData(Advice::SEQUENTIAL); break;
+      case AccessPattern::RANDOM: _adviseData(Advice::RANDOM); break;
+      case AccessPattern::AUTO:
+        // start from a clean slate so detectedAdvice() matches what the kernel was told
+        _adviseData(Advice::NORMAL);
+        _auto_advice = Advice::NORMAL;
+        break;
+    }
+  }
+
+  AccessPattern accessPattern() const { return _pattern; }
+
+  // What AUTO mode currently advises: NORMAL until it has seen a few accesses.
+  Advice detectedAdvice() const { return _auto_advice; }
+
+  // Start reading planes [z0, z1) of stack (t, w) into the page cache.
+  void willNeed(int t, int w, int z0, int z1) const {
+    _validateZWT(0, w, t);
+    for (int z = std::max(z0, 0); z < std::min(z1, hdr.num_planes()); ++z) {
+      _pfile->advise(sectionOffset(t, w, z), frameSize(), Advice::WILL_NEED);
+    }
+  }
+
+  // Section (t, w, z) has been consumed; let the kernel drop it from the page cache.
+  void dontNeed(int t, int w, int z) const {
+    _validateZWT(z, w, t);
+    _pfile->advise(sectionOffset(t, w, z), frameSize(), Advice::DONT_NEED);
+  }
+
+  // Width of the slices returned by readOrthoSlice; their height is the number of planes.
+  int orthoSliceWidth(OrthoAxis axis) const { return axis == OrthoAxis::XZ ? hdr.nx : hdr.ny; }
+
+  /**
+   * Read the XZ slice at row `index` or the YZ slice at column `index` of stack (t, w) into
+   * `array`, one output row per Z plane (num_planes() rows of orthoSliceWidth(axis) pixels).
+   * XZ reads one contiguous row from each plane with a positional read; YZ gathers the column
+   * from a memory map of the file, so only the pages holding it are touched. Planes are
+   * spread over `threads` workers (0 = one per core). Safe to call from several threads.
+   */
+  void readOrthoSlice(int t, int w, OrthoAxis axis, int index, void* array,
+                      unsigned threads = 0) const {
+    if (closed) {
+      throw std::runtime_error("Cannot read from closed file. Please reopen with .open()");
+    }
+    _validateZWT(0, w, t);
+    if (index < 0 || index >= (axis == OrthoAxis::XZ ? hdr.ny : hdr.nx)) {
+      throw std::runtime_error("Slice index out of range");
+    }
+    const size_t pixel = getPixelSize();
+    const size_t width = static_cast<size_t>(orthoSliceWidth(axis));
+    const size_t row_bytes = width * pixel;
+    uint8_t* out = static_cast<uint8_t*>(array);
+
+    if (axis == OrthoAxis::XZ) {
+      parallelFor(
+          hdr.num_planes(),
+          [&](size_t z) {
+            uint64_t offset = sectionOffset(t, w, static_cast<int>(z)) + index * row_bytes;
+            _pfile->read(out + z * row_bytes, row_bytes, offset);
+          },
+          threads);
+    } else {
+      const MappedFile& map = _mapped();
+      const size_t stride = static_cast<size_t>(hdr.nx) * pixel;
+      if (sectionOffset(t, w, hdr.num_planes() - 1) + frameSize() > map.size()) {
+        throw std::runtime_error("Unexpected end of file");
+      }
+      parallelFor(
+          hdr.num_planes(),
+          [&](size_t z) {
+            const uint8_t* src =
+                map.data() + sectionOffset(t, w, static_cast<int>(z)) + index * pixel;
+            gatherStrided(src, stride, pixel, width, out + z * row_bytes);
+          },
+          threads);
+    }
+    _toHostOrder(array, row_bytes * hdr.num_planes());
+  }
+
+  size_t getPixelSize() const { return getPixelTypeSize(static_cast<PixelType>(hdr.mode)); }
 
   void open() {
     if (closed) {
@@ -168,6 +1320,7 @@ class DVFile {
       if (!_file->is_open()) {
         throw std::runtime_error("Failed to open file");
       }
+      _pfile->open(_path);
       closed = false;
     }
   }
@@ -175,6 +1328,8 @@ class DVFile {
   void close() {
     if (!closed) {
       _file->close();
+      _pfile->close();
+      _map.reset();
       closed = true;
     }
   }
@@ -185,8 +1340,16 @@ class DVFile {
 
   IW_MRC_Header getHeader() const { return hdr; }
 
+  // the header without copying it, valid as long as the DVFile
+  const IW_MRC_Header& header() const { return hdr; }
+
+  HeaderView headerView() const { return HeaderView(hdr); }
+
   bool isClosed() const { return closed; }
 
+  // whether the file was written on a big-endian machine
+  bool isBigEndian() const { return _big_endian; }
+
   std::map<std::string, int> sizes() {
     int num_real_z =
         hdr.nz / (hdr.num_waves ? hdr.num_waves : 1) / (hdr.num_times ? hdr.num_times : 1);
@@ -205,6 +1368,434 @@ class DVFile {
   }
 };
 
+// Mean of every section of wavelength w in `file`, as floats.
+std::vector<float> meanFrame(const DVFile& file, int w) {
+  const IW_MRC_Header& h = file.header();
+  const size_t n = static_cast<size_t>(h.nx) * h.ny;
+  const int nt = h.num_times ? h.num_times : 1;
+  std::vector<double> sum(n, 0);
+  std::vector<float> frame(n);
+  for (int t = 0; t < nt; ++t) {
+    for (int z = 0; z < h.num_planes(); ++z) {
+      visitPixelType(static_cast<PixelType>(h.mode), [&](auto tag) {
+        using T = typename decltype(tag)::type;
+        std::vector<T> plane(n);
+        file.readSecAt(plane.data(), t, w, z);
+        for (size_t i = 0; i < n; ++i) sum[i] += static_cast<double>(plane[i]);
+      });
+    }
+  }
+  const double count = static_cast<double>(nt) * h.num_planes();
+  for (size_t i = 0; i < n; ++i) frame[i] = static_cast<float>(sum[i] / count);
+  return frame;
+}
+
+/**
+ * Build a FlatField from a dark and a flat DV file, each holding either one wavelength (used for
+ * all of them) or one per wavelength of the data. All sections of a wavelength are averaged. The
+ * flat is dark-subtracted and normalized to its mean, so correction preserves the mean intensity;
+ * pixels where the flat is not above the dark are set to zero.
+ */
+FlatField loadFlatField(const std::string& dark_path, const std::string& flat_path) {
+  DVFile dark(dark_path);
+  DVFile flat(flat_path);
+  const IW_MRC_Header& dh = dark.header();
+  const IW_MRC_Header& fh = flat.header();
+  const int dark_waves = dh.num_waves ? dh.num_waves : 1;
+  const int flat_waves = fh.num_waves ? fh.num_waves : 1;
+  if (dh.nx != fh.nx || dh.ny != fh.ny) {
+    throw std::runtime_error("Dark and flat images differ in size");
+  }
+  if (dark_waves != flat_waves && dark_waves != 1 && flat_waves != 1) {
+    throw std::runtime_error("Dark and flat images differ in wavelengths");
+  }
+  if (isComplex(static_cast<PixelType>(dh.mode)) || isComplex(static_cast<PixelType>(fh.mode))) {
+    throw std::runtime_error("Dark and flat images cannot be complex");
+  }
+
+  FlatField ff;
+  ff.nx = dh.nx;
+  ff.ny = dh.ny;
+  for (int w = 0; w < dark_waves; ++w) ff.dark.push_back(meanFrame(dark, w));
+  const int nw = std::max(dark_waves, flat_waves);
+  for (int w = 0; w < nw; ++w) {
+    std::vector<float> gain = meanFrame(flat, flat_waves == 1 ? 0 : w);
+    const float* d = ff.dark[dark_waves == 1 ? 0 : w].data();
+    double mean = 0;
+    for (size_t i = 0; i < gain.size(); ++i) {
+      gain[i] -= d[i];
+      mean += gain[i];
+    }
+    mean /= static_cast<double>(gain.size());
+    for (float& g : gain) g = g > 0 ? static_cast<float>(mean / g) : 0.0f;
+    ff.inv_flat.push_back(std::move(gain));
+  }
+  return ff;
+}
+
+// Appends sections to a new DV file. Sections are batched into large sequential writes that a
+// background thread drains from a bounded queue, so producers only block if the disk falls behind
+// by more than `max_queued_bytes`. Timepoints are appended, so T must be the slowest axis.
+class DVWriter {
+ private:
+  std::ofstream _file;
+  std::string _path;
+  IW_MRC_Header hdr;  // guarded by _mutex once the writer thread runs
+  std::vector<char> _ext_header;
+  bool _ext_set = false;  // _ext_header came from setExtendedHeader
+  bool _header_set = false;
+  bool _started = false;
+  bool closed = false;
+  int _num_planes = 0;
+  size_t _frame_size = 0;
+  size_t _sections_per_time = 0;
+  size_t _batch_bytes;
+  size_t _max_queued_bytes;
+  int _header_interval;  // rewrite the header every N completed timepoints
+
+  // producer side
+  std::vector<char> _batch;
+  size_t _sections_queued = 0;
+
+  // shared with the writer thread
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  std::deque<std::vector<char>> _queue;
+  size_t _queued_bytes = 0;
+  size_t _sections_written = 0;
+  bool _busy = false;
+  bool _header_requested = false;
+  bool _stop = false;
+  std::exception_ptr _error;
+  std::thread _thread;
+
+  void _rethrowError() {
+    if (_error) {
+      std::rethrow_exception(_error);
+    }
+  }
+
+  // writer thread only; caller holds no lock
+  void _writeHeaderRecord(const IW_MRC_Header& h) {
+    char raw[sizeof(IW_MRC_Header)];
+    encodeHeader(h, hostIsBigEndian(), raw);
+    std::streampos end = _file.tellp();
+    _file.seekp(0);
+    _file.write(raw, sizeof(IW_MRC_Header));
+    _file.seekp(end);
+    _file.flush();
+    if (!_file) {
+      throw std::runtime_error("Failed to write header to " + _path);
+    }
+  }
+
+  // caller holds _mutex
+  IW_MRC_Header _committedHeader() const {
+    IW_MRC_Header h = hdr;
+    size_t times = _sections_written / _sections_per_time;
+    h.num_times = static_cast<int16_t>(times);
+    h.nz = static_cast<int32_t>(times * _sections_per_time);
+    return h;
+  }
+
+  void _run() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    int times_since_header = 0;
+    while (true) {
+      _cv.wait(lock, [&] { return _stop || _header_requested || !_queue.empty(); });
+      if (_queue.empty()) {
+        if (_header_requested) {
+          IW_MRC_Header h = _committedHeader();
+          lock.unlock();
+          try {
+            _writeHeaderRecord(h);
+          } catch (...) {
+            lock.lock();
+            _error = std::current_exception();
+            _header_requested = false;
+            _cv.notify_all();
+            continue;
+          }
+          lock.lock();
+          _header_requested = false;
+          times_since_header = 0;
+          _cv.notify_all();
+          continue;
+        }
+        break;  // stopped and drained
+      }
+
+      std::vector<char> batch = std::move(_queue.front());
+      _queue.pop_front();
+      _busy = true;
+      size_t before = _sections_written / _sections_per_time;
+      lock.unlock();
+
+      try {
+        _file.write(batch.data(), batch.size());
+        if (!_file) {
+          throw std::runtime_error("Failed to write sections to " + _path);
+        }
+        lock.lock();
+        _sections_written += batch.size() / _frame_size;
+        size_t after = _sections_written / _sections_per_time;
+        times_since_header += static_cast<int>(after - before);
+        if (_header_interval > 0 && times_since_header >= _header_interval) {
+          IW_MRC_Header h = _committedHeader();
+          lock.unlock();
+          _writeHeaderRecord(h);
+          lock.lock();
+          times_since_header = 0;
+        }
+      } catch (...) {
+        if (!lock.owns_lock()) lock.lock();
+        _error = std::current_exception();
+        _queue.clear();
+        _queued_bytes = 0;
+        _busy = false;
+        _cv.notify_all();
+        continue;
+      }
+      _queued_bytes -= batch.size();
+      _busy = false;
+      _cv.notify_all();
+    }
+  }
+
+  void _start() {
+    IW_MRC_Header h = hdr;
+    h.num_times = 0;
+    h.nz = 0;
+    char raw[sizeof(IW_MRC_Header)];
+    encodeHeader(h, hostIsBigEndian(), raw);
+    _file.write(raw, sizeof(IW_MRC_Header));
+    _file.write(_ext_header.data(), _ext_header.size());
+    if (!_file) {
+      throw std::runtime_error("Failed to write header to " + _path);
+    }
+    _thread = std::thread(&DVWriter::_run, this);
+    _started = true;
+  }
+
+  void _enqueue(std::vector<char>&& batch) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    // an oversized batch is still accepted once the queue has drained
+    _cv.wait(lock, [&] {
+      return _error || _queue.empty() || _queued_bytes + batch.size() <= _max_queued_bytes;
+    });
+    _rethrowError();
+    _queued_bytes += batch.size();
+    _queue.push_back(std::move(batch));
+    _cv.notify_all();
+  }
+
+ public:
+  DVWriter(const std::string& path, size_t batch_bytes = 16 << 20,
+           size_t max_queued_bytes = 256 << 20, int header_interval = 1)
+      : _path(path),
+        _batch_bytes(batch_bytes),
+        _max_queued_bytes(max_queued_bytes),
+        _header_interval(header_interval) {
+    _file.open(path, std::ios::binary | std::ios::trunc);
+    if (!_file.is_open()) {
+      throw std::runtime_error("Failed to open file for writing: " + path);
+    }
+    std::memset(&hdr, 0, sizeof(IW_MRC_Header));
+  }
+
+  DVWriter(const std::string& path, const IW_MRC_Header& header) : DVWriter(path) {
+    putHeader(header);
+  }
+
+  DVWriter(const DVWriter&) = delete;
+  DVWriter& operator=(const DVWriter&) = delete;
+
+  ~DVWriter() {
+    try {
+      close();
+    } catch (const std::exception& e) {
+      std::cerr << "Error closing " << _path << ": " << e.what() << std::endl;
+    }
+  }
+
+  // Set the layout of the stream. nx/ny/mode/num_waves and the number of planes per timepoint
+  // (nz / num_waves / num_times) are fixed from here on; nz and num_times grow as data arrives.
+  // An extended header set earlier with setExtendedHeader is kept if it is header.inbsym bytes
+  // long (a mismatch throws); otherwise inbsym zero bytes are reserved.
+  void putHeader(const IW_MRC_Header& header) {
+    if (_started) {
+      throw std::runtime_error("Cannot change the header after sections have been written");
+    }
+    if (getPixelTypeSize(static_cast<PixelType>(header.mode)) == 0) {
+      throw std::runtime_error("Unsupported pixel mode: " + std::to_string(header.mode));
+    }
+    // DVFile refuses files like these, so don't write them
+    if (header.nx <= 0 || header.ny <= 0) {
+      throw std::runtime_error("Invalid dimensions " + std::to_string(header.nx) + " x " +
+                               std::to_string(header.ny));
+    }
+    if (header.interleaved == 0 && header.num_waves > 1) {
+      throw std::runtime_error("Appending timepoints requires T to be the slowest axis");
+    }
+    const size_t ext_size = header.inbsym > 0 ? static_cast<size_t>(header.inbsym) : 0;
+    if (_ext_set && _ext_header.size() != ext_size) {
+      throw std::runtime_error("Header inbsym does not match the extended header already set");
+    }
+    hdr = header;
+    hdr.nDVID = static_cast<int16_t>(0xC0A0);  // native byte order
+    if (hdr.num_waves < 1) hdr.num_waves = 1;
+    _num_planes = header.num_planes();
+    if (_num_planes < 1) _num_planes = 1;
+    _frame_size = static_cast<size_t>(hdr.nx) * hdr.ny * getPixelSize();
+    _sections_per_time = static_cast<size_t>(_num_planes) * hdr.num_waves;
+    hdr.num_times = 1;
+    hdr.nz = static_cast<int32_t>(_sections_per_time);
+    if (!_ext_set) _ext_header.assign(ext_size, 0);
+    hdr.inbsym = static_cast<int32_t>(_ext_header.size());
+    _header_set = true;
+  }
+
+  // Provide the extended header bytes; must be called before the first section is written.
+  // Either order with putHeader works: called after it, this replaces the reserved bytes and
+  // sets inbsym; called before, putHeader keeps these bytes as long as its inbsym matches.
+  void setExtendedHeader(const void* data, size_t size) {
+    if (_started) {
+      throw std::runtime_error(
+          "Cannot change the extended header after sections have been written");
+    }
+    _ext_header.assign(reinterpret_cast<const char*>(data),
+                       reinterpret_cast<const char*>(data) + size);
+    _ext_set = true;
+    hdr.inbsym = static_cast<int32_t>(size);
+  }
+
+  // Update title, min/max/mean in the header. ntflag: 0 = replace all titles, 1 = append title.
+  void setTitle(const char* title, int ntflag) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (title == nullptr) return;
+    int slot = 0;
+    if (ntflag == 1) {
+      slot = hdr.nlab < 10 ? hdr.nlab : 9;
+    } else {
+      std::memset(hdr.label, ' ', sizeof(hdr.label));
+      hdr.nlab = 0;
+    }
+    char* dst = hdr.label + slot * 80;
+    std::memset(dst, ' ', 80);
+    std::memcpy(dst, title, strnlen(title, 80));
+    if (slot >= hdr.nlab) hdr.nlab = slot + 1;
+  }
+
+  void setMinMaxMean(float dmin, float dmax, float dmean) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    hdr.amin = dmin;
+    hdr.amax = dmax;
+    hdr.amean = dmean;
+  }
+
+  // Append the next section in file order.
+  void writeSec(const void* array) {
+    if (closed) {
+      throw std::runtime_error("Cannot write to closed file");
+    }
+    if (!_header_set) {
+      throw std::runtime_error("Header must be set before writing sections");
+    }
+    if (!_started) {
+      _start();
+    }
+    size_t times = (_sections_queued + 1 + _sections_per_time - 1) / _sections_per_time;
+    if (times > static_cast<size_t>(INT16_MAX)) {
+      throw std::runtime_error("Too many timepoints for a DV header");
+    }
+    if (_batch.capacity() < _batch_bytes) {
+      _batch.reserve(_batch_bytes + _frame_size);
+    }
+    const char* src = reinterpret_cast<const char*>(array);
+    _batch.insert(_batch.end(), src, src + _frame_size);
+    _sections_queued++;
+    if (_batch.size() >= _batch_bytes) {
+      _enqueue(std::move(_batch));
+      _batch = std::vector<char>();
+    }
+  }
+
+  // Append a full timepoint: num_waves * num_planes sections in file order.
+  void writeTimepoint(const void* array) {
+    const char* src = reinterpret_cast<const char*>(array);
+    for (size_t i = 0; i < _sections_per_time; ++i) {
+      writeSec(src + i * _frame_size);
+    }
+  }
+
+  // Block until everything queued so far is on disk and the header reflects it.
+  void flush() {
+    if (!_started) return;
+    if (!_batch.empty()) {
+      _enqueue(std::move(_batch));
+      _batch = std::vector<char>();
+    }
+    std::unique_lock<std::mutex> lock(_mutex);
+    _header_requested = true;
+    _cv.notify_all();
+    _cv.wait(lock, [&] { return _error || (!_header_requested && _queue.empty() && !_busy); });
+    _rethrowError();
+  }
+
+  void close() {
+    if (closed) return;
+    closed = true;
+    if (_header_set && !_started) {
+      _start();
+    }
+    flush();
+    if (_thread.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+      }
+      _cv.notify_all();
+      _thread.join();
+    }
+    _file.close();
+    if (_header_set && _sections_queued % _sections_per_time != 0) {
+      std::cerr << "Warning: " << _path << " ends with an incomplete timepoint ("
+                << _sections_queued % _sections_per_time << " extra sections)" << std::endl;
+    }
+    _rethrowError();
+  }
+
+  size_t getPixelSize() { return getPixelTypeSize(static_cast<PixelType>(hdr.mode)); }
+
+  std::string getPath() const { return _path; }
+
+  bool isClosed() const { return closed; }
+
+  // header as last committed to disk
+  IW_MRC_Header getHeader() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _started ? _committedHeader() : hdr;
+  }
+
+  // Call fn(const IW_MRC_Header&) with the header as getHeader would return it, under the lock.
+  // Until the first section is queued that is the writer's own header, not a copy.
+  template <typename Fn>
+  void visitHeader(Fn&& fn) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_started) {
+      fn(static_cast<const IW_MRC_Header&>(hdr));
+      return;
+    }
+    const IW_MRC_Header committed = _committedHeader();
+    fn(committed);
+  }
+
+  // number of complete timepoints handed to the writer
+  int numTimesQueued() const {
+    return _sections_per_time ? static_cast<int>(_sections_queued / _sections_per_time) : 0;
+  }
+};
+
 //////////////////////////////////////////////////////////////////////////////
 // IVE API
 //////////////////////////////////////////////////////////////////////////////
@@ -220,6 +1811,22 @@ DVFile& getDVFile(int istream) {
   return *(it->second);
 }
 
+// stream -> DVWriter (streams opened as "new")
+std::map<int, std::unique_ptr<DVWriter>> dvwriter_map;
+
+DVWriter* findDVWriter(int istream) {
+  auto it = dvwriter_map.find(istream);
+  return it == dvwriter_map.end() ? nullptr : it->second.get();
+}
+
+DVWriter& getDVWriter(int istream) {
+  DVWriter* writer = findDVWriter(istream);
+  if (writer == nullptr) {
+    throw std::runtime_error("Stream not opened for writing: " + std::to_string(istream));
+  }
+  return *writer;
+}
+
 // attrib is one of "ro" or "new"
 int IMOpen(int istream, const char* name, const char* attrib) {
   // Check if the stream identifier is already in use and close it if necessary
@@ -229,6 +1836,11 @@ int IMOpen(int istream, const char* name, const char* attrib) {
     std::cerr << "Warning: Reusing stream identifier " << istream << ". Previous stream closed."
               << std::endl;
   }
+  if (dvwriter_map.find(istream) != dvwriter_map.end()) {
+    dvwriter_map.erase(istream);
+    std::cerr << "Warning: Reusing stream identifier " << istream << ". Previous stream closed."
+              << std::endl;
+  }
 
   if (std::string(attrib) == "ro") {
     try {
@@ -237,6 +1849,13 @@ int IMOpen(int istream, const char* name, const char* attrib) {
       std::cerr << "Error: " << e.what() << std::endl;
       return -1;  // Return non-zero to indicate failure
     }
+  } else if (std::string(attrib) == "new") {
+    try {
+      dvwriter_map[istream] = std::make_unique<DVWriter>(name);
+    } catch (const std::exception& e) {
+      std::cerr << "Error: " << e.what() << std::endl;
+      return -1;
+    }
   } else {
     std::cerr << "Unknown file mode: " << attrib << std::endl;
     return -1;  // Return non-zero to indicate failure
@@ -247,24 +1866,46 @@ int IMOpen(int istream, const char* name, const char* attrib) {
 void IMClose(int istream) {
   // call destructor of DVFile
   dvfile_map.erase(istream);
+  if (DVWriter* writer = findDVWriter(istream)) {
+    try {
+      writer->close();
+    } catch (const std::exception& e) {
+      std::cerr << "Error closing stream: " << e.what() << std::endl;
+    }
+    dvwriter_map.erase(istream);
+  }
+}
+
+// Call fn(const IW_MRC_Header&) with the header of a stream where it is held, so IVE calls that
+// need a few fields read them in place rather than copying all 1024 bytes out first.
+template <typename Fn>
+void visitStreamHeader(int istream, Fn&& fn) {
+  if (DVWriter* writer = findDVWriter(istream)) {
+    writer->visitHeader(fn);
+    return;
+  }
+  fn(getDVFile(istream).header());
 }
 
-void IMGetHdr(int istream, IW_MRC_HEADER* header) { *header = getDVFile(istream).getHeader(); }
+void IMGetHdr(int istream, IW_MRC_HEADER* header) {
+  visitStreamHeader(istream, [&](const IW_MRC_Header& h) { *header = h; });
+}
 
 void IMRdHdr(int istream, int ixyz[3], int mxyz[3], int* imode, float* min, float* max,
              float* mean) {
-  IW_MRC_HEADER header;
-  IMGetHdr(istream, &header);
-  ixyz[0] = header.nx;
-  ixyz[1] = header.ny;
-  ixyz[2] = header.nz;
-  mxyz[0] = header.mx;
-  mxyz[1] = header.my;
-  mxyz[2] = header.mz;
-  *imode = header.mode;
-  *min = header.amin;
-  *max = header.amax;
-  *mean = header.amean;
+  visitStreamHeader(istream, [&](const IW_MRC_Header& h) {
+    HeaderView header(h);
+    ixyz[0] = header->nx;
+    ixyz[1] = header->ny;
+    ixyz[2] = header->nz;
+    mxyz[0] = header->mx;
+    mxyz[1] = header->my;
+    mxyz[2] = header->mz;
+    *imode = header->mode;
+    *min = header->amin;
+    *max = header->amax;
+    *mean = header->amean;
+  });
 }
 
 /**
@@ -364,10 +2005,55 @@ void IMRdSec(int istream, void* ImgBuffer) {
   }
 }
 
+/**
+ * @brief Set the header of a stream opened as "new".
+ *
+ * Must be called before the first IMWrSec. The header fixes nx, ny, mode, the number of
+ * wavelengths and the number of planes per timepoint; nz and num_times grow as sections are
+ * written and are rewritten on disk as each timepoint completes.
+ *
+ * @param istream The output stream to be used for the operation.
+ * @param header The header describing the data to be written.
+ */
 void IMPutHdr(int istream, const IW_MRC_HEADER* header) {
-  std::cerr << "Warning: IMPutHdr is not implemented." << std::endl;
+  // like IMWrHdr and IMWrSec, throws for streams not opened as "new"
+  getDVWriter(istream).putHeader(*header);
+}
+
+/**
+ * @brief Write the header to disk with a new title and min/max/mean values.
+ *
+ * @param istream The output stream to be used for the operation.
+ * @param title An 80-character title.
+ * @param ntflag 0 to replace all titles with this one, 1 to append it to the existing titles.
+ * @param dmin The minimum intensity.
+ * @param dmax The maximum intensity.
+ * @param dmean The mean intensity.
+ */
+void IMWrHdr(int istream, const char title[80], int ntflag, float dmin, float dmax, float dmean) {
+  DVWriter& writer = getDVWriter(istream);
+  writer.setTitle(title, ntflag);
+  writer.setMinMaxMean(dmin, dmax, dmean);
+  writer.flush();
+}
+
+/**
+ * @brief Append a section to a stream opened as "new".
+ *
+ * Sections are written in file order. The data are queued and written to disk in large batches
+ * by a background thread; IMClose (or IMWrHdr) waits for them to land.
+ *
+ * @param istream The output stream to be used for the operation.
+ * @param array The section data, nx * ny pixels of the stream's pixel type.
+ */
+void IMWrSec(int istream, const void* array) {
+  try {
+    getDVWriter(istream).writeSec(array);
+  } catch (const std::runtime_error& e) {
+    std::cerr << "Error writing section: " << e.what() << std::endl;
+    throw;
+  }
 }
-// not yet implemented ///////////////////////////////////
 
 /**
  * @brief Return extended header values for a particular Z section, wavelength,
@@ -377,13 +2063,18 @@ void IMPutHdr(int istream, const IW_MRC_HEADER* header) {
  * wavelength (WaveNum), and time-point (TimeNum) are returned in IntValues and
  * FloatValues, respectively.
  *
+ * @param istream The input stream to be used for the operation.
+ * @param iz The Z section.
+ * @param iw The wavelength.
+ * @param it The time-point.
+ * @param ival Receives the header's nint integer values.
+ * @param rval Receives the header's nreal floating-point values.
  */
 void IMRtExHdrZWT(int istream, int iz, int iw, int it, int ival[], float rval[]) {
-  std::cerr << "Warning: IMRtExHdrZWT is not implemented." << std::endl;
-}
-void IMWrHdr(int istream, const char title[80], int ntflag, float dmin, float dmax, float dmean) {
-  std::cerr << "Warning: IMWrHdr is not implemented." << std::endl;
+  try {
+    getDVFile(istream).readSectionRecord(it, iw, iz, reinterpret_cast<int32_t*>(ival), rval);
+  } catch (const std::runtime_error& e) {
+    std::cerr << "Error reading extended header: " << e.what() << std::endl;
+    throw;
+  }
 }
-void IMWrSec(int istream, const void* array) {
-  std::cerr << "Warning: IMWrSec is not implemented." << std::endl;
-}
\ No newline at end of file
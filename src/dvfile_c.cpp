@@ -0,0 +1,109 @@
+#include "dvfile_c.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "dvfile.h"
+
+struct dv_file {
+  std::unique_ptr<DVFile> file;
+  std::unique_ptr<MappedFile> map;
+  IW_MRC_Header hdr;
+  std::atomic<int> refs{1};  // the handle plus one per live view
+};
+
+namespace {
+
+thread_local std::string last_error;
+
+int fail(const std::string& message) {
+  last_error = message;
+  return -1;
+}
+
+void unref(dv_file* file) {
+  if (file->refs.fetch_sub(1) == 1) delete file;
+}
+
+}  // namespace
+
+int dv_open(const char* path, dv_file** out) {
+  if (path == nullptr || out == nullptr) return fail("Invalid argument");
+  try {
+    std::unique_ptr<dv_file> handle(new dv_file);
+    handle->file = std::make_unique<DVFile>(path);
+    handle->hdr = handle->file->getHeader();
+    handle->map = std::make_unique<MappedFile>(path);
+    // the mapping serves all reads, the stream is no longer needed
+    handle->file->close();
+    *out = handle.release();
+    return 0;
+  } catch (const std::exception& e) {
+    return fail(e.what());
+  }
+}
+
+void dv_close(dv_file* file) {
+  if (file != nullptr) unref(file);
+}
+
+int dv_get_info(const dv_file* file, dv_info* out) {
+  if (file == nullptr || out == nullptr) return fail("Invalid argument");
+  const IW_MRC_Header& hdr = file->hdr;
+  out->nx = hdr.nx;
+  out->ny = hdr.ny;
+  out->num_planes = hdr.num_planes();
+  out->num_waves = hdr.num_waves ? hdr.num_waves : 1;
+  out->num_times = hdr.num_times ? hdr.num_times : 1;
+  out->mode = hdr.mode;
+  out->interleaved = hdr.interleaved;
+  out->xlen = hdr.xlen;
+  out->ylen = hdr.ylen;
+  out->zlen = hdr.zlen;
+  out->itemsize = file->file->getPixelSize();
+  out->byteorder = file->file->isBigEndian() ? '>' : '<';
+  return 0;
+}
+
+int dv_get_header(const dv_file* file, void* out) {
+  if (file == nullptr || out == nullptr) return fail("Invalid argument");
+  std::memcpy(out, &file->hdr, sizeof(IW_MRC_Header));
+  return 0;
+}
+
+int dv_view_section(dv_file* file, int t, int w, int z, dv_view* out) {
+  if (file == nullptr || out == nullptr) return fail("Invalid argument");
+  const IW_MRC_Header& hdr = file->hdr;
+  // a count of 0 means a single time point or wavelength, as in DVFile
+  const int nt = hdr.num_times ? hdr.num_times : 1;
+  const int nw = hdr.num_waves ? hdr.num_waves : 1;
+  if (t < 0 || t >= nt || w < 0 || w >= nw || z < 0 || z >= hdr.num_planes()) {
+    return fail("Section index out of range");
+  }
+  const size_t itemsize = file->file->getPixelSize();
+  const uint64_t offset = file->file->sectionOffset(t, w, z);
+  if (offset + file->file->frameSize() > file->map->size()) {
+    return fail("Section lies beyond the end of the file");
+  }
+  file->refs.fetch_add(1);
+  out->data = file->map->data() + offset;
+  out->shape[0] = hdr.ny;
+  out->shape[1] = hdr.nx;
+  out->strides[0] = static_cast<int64_t>(hdr.nx * itemsize);
+  out->strides[1] = static_cast<int64_t>(itemsize);
+  out->mode = hdr.mode;
+  out->itemsize = itemsize;
+  out->byteorder = file->file->isBigEndian() ? '>' : '<';
+  out->owner = file;
+  return 0;
+}
+
+void dv_release(dv_view* view) {
+  if (view == nullptr || view->owner == nullptr) return;
+  unref(static_cast<dv_file*>(view->owner));
+  view->owner = nullptr;
+  view->data = nullptr;
+}
+
+const char* dv_last_error(void) { return last_error.c_str(); }
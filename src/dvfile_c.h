@@ -0,0 +1,78 @@
+/*
+ * C interface to dvfile for language bindings.
+ *
+ * Sections are returned as views straight into a read-only memory map of the file, so bindings
+ * can wrap them without copying (e.g. as a numpy array or a Julia unsafe_wrap). A view keeps the
+ * mapping alive: the file is unmapped once it has been closed and every view released.
+ *
+ * Functions returning int return 0 on success and -1 on failure; dv_last_error() then describes
+ * the failure on the calling thread.
+ */
+#ifndef DVFILE_C_H
+#define DVFILE_C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#ifdef DVFILE_C_BUILD
+#define DV_API __declspec(dllexport)
+#else
+#define DV_API __declspec(dllimport)
+#endif
+#else
+#define DV_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct dv_file dv_file;
+
+typedef struct dv_info {
+  int32_t nx, ny;
+  int32_t num_planes, num_waves, num_times;
+  int32_t mode;         /* PixelType */
+  int32_t interleaved;  /* 0 = ZTW, 1 = WZT, 2 = ZWT */
+  float xlen, ylen, zlen;
+  size_t itemsize;      /* bytes per pixel */
+  char byteorder;       /* '<' little endian, '>' big endian */
+} dv_info;
+
+typedef struct dv_view {
+  const void* data;    /* first pixel of the section */
+  int64_t shape[2];    /* ny, nx */
+  int64_t strides[2];  /* in bytes */
+  int32_t mode;
+  size_t itemsize;
+  char byteorder;
+  void* owner; /* internal, do not touch */
+} dv_view;
+
+/* Open a DV file. On success *out owns one reference to the file. */
+DV_API int dv_open(const char* path, dv_file** out);
+
+/* Drop the handle's reference; the mapping lives on until every view is released. */
+DV_API void dv_close(dv_file* file);
+
+DV_API int dv_get_info(const dv_file* file, dv_info* out);
+
+/* Copy the 1024-byte header, decoded to host byte order (not the bytes on disk for files of
+   the other byte order; see dv_info.byteorder). */
+DV_API int dv_get_header(const dv_file* file, void* out);
+
+/* Fill *out with a zero-copy view of section (t, w, z); the view holds a reference. */
+DV_API int dv_view_section(dv_file* file, int t, int w, int z, dv_view* out);
+
+/* Release the reference held by a view. Safe to call on a zeroed view. */
+DV_API void dv_release(dv_view* view);
+
+/* Message describing the last failure on this thread. */
+DV_API const char* dv_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DVFILE_C_H */
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "dvfile.h"
+#include "dvparallel.h"
+
+struct HistogramOptions {
+  // Use every stride-th (t, z) section of each wavelength; 1 reads the whole volume, larger
+  // values give an approximate histogram for quick display limits.
+  int stride = 1;
+  // bins for FLOAT32 and INT32 data, spread over the data's range; 8 and 16-bit types always get
+  // one bin per value
+  size_t bins = 65536;
+  unsigned threads = 0;  // section readers (0 = one per core)
+};
+
+struct Histogram {
+  double lo = 0;         // lower edge of the first bin
+  double bin_width = 1;  // 1 for the exact integer histograms
+  bool exact = true;     // one bin per possible value
+  std::vector<uint64_t> counts;
+  uint64_t total = 0;
+
+  /**
+   * Value below which `p` percent of the counted pixels lie. Exact histograms return a pixel
+   * value; binned ones interpolate linearly within the bin.
+   */
+  double percentile(double p) const {
+    if (total == 0) return lo;
+    const double target = std::min(std::max(p, 0.0), 100.0) / 100.0 * static_cast<double>(total);
+    uint64_t seen = 0;
+    for (size_t b = 0; b < counts.size(); ++b) {
+      if (counts[b] == 0) continue;
+      if (static_cast<double>(seen + counts[b]) >= target) {
+        if (exact) return lo + static_cast<double>(b);
+        double within = (target - static_cast<double>(seen)) / static_cast<double>(counts[b]);
+        return lo + (static_cast<double>(b) + within) * bin_width;
+      }
+      seen += counts[b];
+    }
+    return lo + static_cast<double>(counts.size()) * bin_width;
+  }
+
+  // Display limits at the given low and high percentiles.
+  std::pair<double, double> limits(double low = 0.1, double high = 99.9) const {
+    return {percentile(low), percentile(high)};
+  }
+};
+
+/**
+ * @brief Histogram of every wavelength of `file`.
+ *
+ * Sampled sections are grouped by wavelength and split over workers with parallelForStealing.
+ * Each worker counts into one private table for the wavelength it is on and merges it into the
+ * result under a lock when it moves to another wavelength, so the counting loops carry no atomics
+ * and memory stays at one table per worker. 8 and 16-bit data
+ * get exact one-bin-per-value histograms in a single pass. FLOAT32 and INT32 data take a first
+ * pass for the range of each wavelength and then spread `options.bins` bins over it. Complex
+ * data are not supported.
+ *
+ * @return One histogram per wavelength.
+ */
+std::vector<Histogram> computeHistograms(const DVFile& file,
+                                         const HistogramOptions& options = HistogramOptions()) {
+  const IW_MRC_Header& hdr = file.header();
+  const PixelType type = static_cast<PixelType>(hdr.mode);
+  if (isComplex(type)) {
+    throw std::runtime_error("Histograms are not supported for complex data");
+  }
+  if (options.stride < 1 || options.bins < 1) {
+    throw std::runtime_error("Histogram stride and bins must be at least 1");
+  }
+  const int nw = hdr.num_waves ? hdr.num_waves : 1;
+  const int nz = hdr.num_planes();
+
+  // sampled sections by wavelength, then in file order, so each worker's share of the list
+  // mostly stays on one wavelength and reads forward through the file
+  struct Sampled {
+    size_t index;  // in the file
+    int w;
+  };
+  std::vector<Sampled> sections;
+  for (int i = 0; i < hdr.nz; ++i) {
+    int t, w, z;
+    hdr.section_zwt(i, t, w, z);
+    if ((t * nz + z) % options.stride == 0) sections.push_back({static_cast<size_t>(i), w});
+  }
+  std::stable_sort(sections.begin(), sections.end(),
+                   [](const Sampled& a, const Sampled& b) { return a.w < b.w; });
+
+  const unsigned threads = options.threads ? options.threads : defaultThreadCount();
+  const size_t frame = file.frameSize();
+  std::vector<std::vector<char>> buffers(threads);
+  std::vector<Histogram> result(nw);
+
+  visitPixelType(type, [&](auto tag) {
+    using T = typename decltype(tag)::type;
+    const size_t pixels = frame / sizeof(T);
+    constexpr bool exact = std::is_integral<T>::value && sizeof(T) <= 2;
+
+    // range of each wavelength: the type's range, or measured in a first pass
+    std::vector<double> lo(nw), hi(nw);
+    if constexpr (exact) {
+      std::fill(lo.begin(), lo.end(), static_cast<double>(std::numeric_limits<T>::lowest()));
+      std::fill(hi.begin(), hi.end(), static_cast<double>(std::numeric_limits<T>::max()));
+    } else {
+      std::vector<double> wlo(static_cast<size_t>(threads) * nw,
+                              std::numeric_limits<double>::infinity());
+      std::vector<double> whi(static_cast<size_t>(threads) * nw,
+                              -std::numeric_limits<double>::infinity());
+      parallelForStealing(
+          sections.size(),
+          [&](size_t k, unsigned worker) {
+            std::vector<char>& buffer = buffers[worker];
+            buffer.resize(frame);
+            file.readSecIndexAt(buffer.data(), sections[k].index);
+            const size_t slot = static_cast<size_t>(worker) * nw + sections[k].w;
+            minMax(reinterpret_cast<const T*>(buffer.data()), pixels, wlo[slot], whi[slot]);
+          },
+          threads);
+      for (int w = 0; w < nw; ++w) {
+        lo[w] = std::numeric_limits<double>::infinity();
+        hi[w] = -std::numeric_limits<double>::infinity();
+        for (unsigned k = 0; k < threads; ++k) {
+          lo[w] = std::min(lo[w], wlo[static_cast<size_t>(k) * nw + w]);
+          hi[w] = std::max(hi[w], whi[static_cast<size_t>(k) * nw + w]);
+        }
+        if (lo[w] > hi[w]) lo[w] = hi[w] = 0;  // nothing finite
+      }
+    }
+
+    std::vector<size_t> bins(nw);
+    for (int w = 0; w < nw; ++w) {
+      Histogram& h = result[w];
+      h.exact = exact;
+      h.lo = lo[w];
+      if (exact) {
+        bins[w] = static_cast<size_t>(hi[w] - lo[w]) + 1;
+        h.bin_width = 1;
+      } else {
+        bins[w] = options.bins;
+        h.bin_width = (hi[w] - lo[w]) / static_cast<double>(bins[w]);  // 0 if all equal
+      }
+      h.counts.assign(bins[w], 0);
+    }
+
+    // one table per worker, for the wavelength it is counting; flushed into the result when the
+    // worker moves on to another wavelength and once at the end
+    std::vector<std::vector<uint64_t>> tables(threads);
+    std::vector<int> table_wave(threads, -1);
+    std::mutex merge_mutex;
+    auto flush = [&](unsigned worker) {
+      const int w = table_wave[worker];
+      if (w < 0) return;
+      std::vector<uint64_t>& counts = tables[worker];
+      std::lock_guard<std::mutex> lock(merge_mutex);
+      for (size_t b = 0; b < counts.size(); ++b) result[w].counts[b] += counts[b];
+    };
+    parallelForStealing(
+        sections.size(),
+        [&](size_t k, unsigned worker) {
+          std::vector<char>& buffer = buffers[worker];
+          buffer.resize(frame);
+          file.readSecIndexAt(buffer.data(), sections[k].index);
+          const int w = sections[k].w;
+          std::vector<uint64_t>& counts = tables[worker];
+          if (table_wave[worker] != w) {
+            flush(worker);
+            counts.assign(bins[w], 0);
+            table_wave[worker] = w;
+          }
+          const T* src = reinterpret_cast<const T*>(buffer.data());
+          if constexpr (exact) {
+            accumulateHistogram(src, pixels, static_cast<int64_t>(lo[w]), counts.data());
+          } else {
+            const double width = result[w].bin_width;
+            accumulateHistogramScaled(src, pixels, lo[w], width > 0 ? 1 / width : 0, bins[w],
+                                      counts.data());
+          }
+        },
+        threads);
+
+    for (unsigned k = 0; k < threads; ++k) flush(k);
+    for (Histogram& h : result) {
+      for (uint64_t c : h.counts) h.total += c;
+    }
+  });
+  return result;
+}
@@ -0,0 +1,301 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+// Pixel kernels shared by the pyramid builder and the binned and corrected read paths. The loops
+// are written over contiguous arrays with no aliasing between source and destination so the
+// compiler can vectorize them; the 2x case gets its own loop since that is by far the most
+// common factor.
+
+// Accumulator wide enough to sum many pixels of type T without overflow.
+template <typename T>
+struct Accumulator {
+  using type = std::conditional_t<
+      std::is_floating_point<T>::value, double,
+      std::conditional_t<(sizeof(T) < 4), std::conditional_t<std::is_signed<T>::value, int32_t,
+                                                              uint32_t>,
+                         int64_t>>;
+};
+
+template <typename T>
+using accumulator_t = typename Accumulator<T>::type;
+
+// Add the fx-by-fy block sums of an nx-by-ny plane into acc, which holds (nx / fx) * (ny / fy)
+// values. Trailing rows and columns that do not fill a whole block are ignored.
+template <typename T, typename A>
+void accumulateBlocks(const T* src, int nx, int ny, int fx, int fy, A* acc) {
+  const int ox_n = nx / fx;
+  const int oy_n = ny / fy;
+  for (int oy = 0; oy < oy_n; ++oy) {
+    A* out = acc + static_cast<size_t>(oy) * ox_n;
+    for (int dy = 0; dy < fy; ++dy) {
+      const T* row = src + static_cast<size_t>(oy * fy + dy) * nx;
+      if (fx == 1) {
+        for (int ox = 0; ox < ox_n; ++ox) out[ox] += static_cast<A>(row[ox]);
+      } else if (fx == 2) {
+        for (int ox = 0; ox < ox_n; ++ox) {
+          out[ox] += static_cast<A>(row[2 * ox]) + static_cast<A>(row[2 * ox + 1]);
+        }
+      } else {
+        for (int ox = 0; ox < ox_n; ++ox) {
+          const T* block = row + static_cast<size_t>(ox) * fx;
+          A sum = 0;
+          for (int dx = 0; dx < fx; ++dx) sum += static_cast<A>(block[dx]);
+          out[ox] += sum;
+        }
+      }
+    }
+  }
+}
+
+// Convert an accumulated value back to T, rounding to nearest and saturating at T's range; NaN
+// becomes 0.
+template <typename T, typename A>
+T saturateCast(A value) {
+  if constexpr (std::is_floating_point<T>::value) {
+    return static_cast<T>(value);
+  }
+  using L = std::numeric_limits<T>;
+  if constexpr (std::is_floating_point<A>::value) {
+    if (value != value) return T(0);  // NaN has no integer value; casting it is undefined
+  }
+  // >= rather than clamping first: float(INT32_MAX) rounds up to 2^31, past T's range
+  if (value <= static_cast<A>(L::lowest())) return L::lowest();
+  if (value >= static_cast<A>(L::max())) return L::max();
+  return static_cast<T>(value);
+}
+
+// dst[i] = acc[i] / count, rounded to nearest for integer types.
+template <typename T, typename A>
+void storeMean(const A* acc, size_t n, A count, T* dst) {
+  if constexpr (std::is_floating_point<A>::value) {
+    const A scale = A(1) / count;
+    for (size_t i = 0; i < n; ++i) dst[i] = static_cast<T>(acc[i] * scale);
+    return;
+  }
+  const A half = count / 2;
+  for (size_t i = 0; i < n; ++i) {
+    A v = acc[i];
+    dst[i] = static_cast<T>(v >= 0 ? (v + half) / count : -((-v + half) / count));
+  }
+}
+
+// dst[i] = acc[i], saturated to T's range.
+template <typename T, typename A>
+void storeSum(const A* acc, size_t n, T* dst) {
+  for (size_t i = 0; i < n; ++i) dst[i] = saturateCast<T>(acc[i]);
+}
+
+// dst[i] = (src[i] - dark[i]) * inv_flat[i], computed in float. Integer destinations are rounded
+// to nearest and saturated at U's range, with NaN stored as 0.
+template <typename T, typename U>
+void correctFlatDark(const T* src, const float* dark, const float* inv_flat, size_t n, U* dst) {
+  if constexpr (std::is_floating_point<U>::value) {
+    for (size_t i = 0; i < n; ++i) {
+      dst[i] = static_cast<U>((static_cast<float>(src[i]) - dark[i]) * inv_flat[i]);
+    }
+    return;
+  }
+  using L = std::numeric_limits<U>;
+  const float lo = static_cast<float>(L::lowest());
+  const float hi = static_cast<float>(L::max());
+  for (size_t i = 0; i < n; ++i) {
+    float v = (static_cast<float>(src[i]) - dark[i]) * inv_flat[i];
+    v += v < 0 ? -0.5f : 0.5f;
+    // the limits are returned directly since hi may round past U's range (float(INT32_MAX) is
+    // 2^31); NaN, e.g. from a zero flat, becomes 0
+    dst[i] = v != v ? U(0) : v >= hi ? L::max() : v <= lo ? L::lowest() : static_cast<U>(v);
+  }
+}
+
+// Difference statistics of a against b: the largest |a[i] - b[i]| and the sum of squared
+// differences. Types of up to 16 bits use exact integer arithmetic, which vectorizes; wider
+// types accumulate in double.
+template <typename T>
+void diffStats(const T* a, const T* b, size_t n, double& max_abs, double& sum_sq) {
+  if constexpr (std::is_integral<T>::value && sizeof(T) <= 2) {
+    int32_t m = 0;
+    int64_t s = 0;
+    for (size_t i = 0; i < n; ++i) {
+      int32_t d = static_cast<int32_t>(a[i]) - static_cast<int32_t>(b[i]);
+      d = d < 0 ? -d : d;
+      m = std::max(m, d);
+      s += static_cast<int64_t>(d) * d;
+    }
+    max_abs = m;
+    sum_sq = static_cast<double>(s);
+  } else {
+    double m = 0;
+    double s = 0;
+    for (size_t i = 0; i < n; ++i) {
+      double d = static_cast<double>(a[i]) - static_cast<double>(b[i]);
+      d = d < 0 ? -d : d;
+      m = std::max(m, d);
+      s += d * d;
+    }
+    max_abs = m;
+    sum_sq = s;
+  }
+}
+
+// Largest |a[i]|.
+template <typename T>
+double maxAbs(const T* a, size_t n) {
+  double m = 0;
+  for (size_t i = 0; i < n; ++i) {
+    double v = static_cast<double>(a[i]);
+    m = std::max(m, v < 0 ? -v : v);
+  }
+  return m;
+}
+
+// counts[src[i] - offset] += 1 for integer pixels known to lie in the table. Kept as a plain loop
+// over a private table per thread: no atomics, and 8/16-bit tables stay cache resident.
+template <typename T>
+void accumulateHistogram(const T* src, size_t n, int64_t offset, uint64_t* counts) {
+  for (size_t i = 0; i < n; ++i) ++counts[static_cast<int64_t>(src[i]) - offset];
+}
+
+// Histogram of values in [lo, lo + bins / scale) with bins of width 1 / scale; values outside
+// the range (infinities included) go to the end bins and NaNs are skipped.
+template <typename T>
+void accumulateHistogramScaled(const T* src, size_t n, double lo, double scale, size_t bins,
+                               uint64_t* counts) {
+  const double last = static_cast<double>(bins - 1);
+  for (size_t i = 0; i < n; ++i) {
+    double v = static_cast<double>(src[i]);
+    if (v != v) continue;
+    // (inf - lo) * 0 is NaN, so infinities are placed before scaling
+    double b = std::isinf(v) ? (v < 0 ? 0.0 : last) : (v - lo) * scale;
+    b = std::min(std::max(b, 0.0), last);
+    ++counts[static_cast<size_t>(b)];
+  }
+}
+
+// Smallest and largest finite values, folded into lo and hi.
+template <typename T>
+void minMax(const T* src, size_t n, double& lo, double& hi) {
+  T mn = std::numeric_limits<T>::max();
+  T mx = std::numeric_limits<T>::lowest();
+  for (size_t i = 0; i < n; ++i) {
+    if constexpr (std::is_floating_point<T>::value) {
+      if (!std::isfinite(src[i])) continue;
+    }
+    mn = std::min(mn, src[i]);
+    mx = std::max(mx, src[i]);
+  }
+  if (mn <= mx) {
+    lo = std::min(lo, static_cast<double>(mn));
+    hi = std::max(hi, static_cast<double>(mx));
+  }
+}
+
+// Kernels over n interleaved (real, imag) pairs; component `which` is 0 for real, 1 for imag.
+template <typename T>
+void complexComponent(const T* src, size_t n, int which, float* dst) {
+  for (size_t i = 0; i < n; ++i) dst[i] = static_cast<float>(src[2 * i + which]);
+}
+
+template <typename T>
+void complexPower(const T* src, size_t n, float* dst) {
+  for (size_t i = 0; i < n; ++i) {
+    float re = static_cast<float>(src[2 * i]);
+    float im = static_cast<float>(src[2 * i + 1]);
+    dst[i] = re * re + im * im;
+  }
+}
+
+template <typename T>
+void complexMagnitude(const T* src, size_t n, float* dst) {
+  complexPower(src, n, dst);
+  for (size_t i = 0; i < n; ++i) dst[i] = std::sqrt(dst[i]);
+}
+
+// Phase in radians, in [-pi, pi].
+template <typename T>
+void complexPhase(const T* src, size_t n, float* dst) {
+  for (size_t i = 0; i < n; ++i) {
+    dst[i] = std::atan2(static_cast<float>(src[2 * i + 1]), static_cast<float>(src[2 * i]));
+  }
+}
+
+template <typename T>
+void splitComplex(const T* src, size_t n, T* real, T* imag) {
+  for (size_t i = 0; i < n; ++i) {
+    real[i] = src[2 * i];
+    imag[i] = src[2 * i + 1];
+  }
+}
+
+// Copy n elements of `size` bytes spaced `stride` bytes apart in src to contiguous dst. The
+// common pixel sizes get fixed-size copies the compiler turns into plain loads and stores.
+inline void gatherStrided(const uint8_t* src, size_t stride, size_t size, size_t n,
+                          uint8_t* dst) {
+  switch (size) {
+    case 1:
+      for (size_t i = 0; i < n; ++i) dst[i] = src[i * stride];
+      break;
+    case 2:
+      for (size_t i = 0; i < n; ++i) std::memcpy(dst + 2 * i, src + i * stride, 2);
+      break;
+    case 4:
+      for (size_t i = 0; i < n; ++i) std::memcpy(dst + 4 * i, src + i * stride, 4);
+      break;
+    case 8:
+      for (size_t i = 0; i < n; ++i) std::memcpy(dst + 8 * i, src + i * stride, 8);
+      break;
+    default:
+      for (size_t i = 0; i < n; ++i) std::memcpy(dst + size * i, src + i * stride, size);
+  }
+}
+
+// Sums needed for the mean absolute difference and Pearson correlation of two planes.
+struct PairSums {
+  double abs_diff = 0;
+  double a = 0, b = 0;
+  double aa = 0, bb = 0, ab = 0;
+};
+
+// Accumulate PairSums over n pixels. Types of up to 16 bits sum exactly in 64-bit integers,
+// which vectorizes; wider types sum in double.
+template <typename T>
+PairSums pairSums(const T* a, const T* b, size_t n) {
+  PairSums s;
+  if constexpr (std::is_integral<T>::value && sizeof(T) <= 2) {
+    int64_t d = 0, sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+    for (size_t i = 0; i < n; ++i) {
+      int64_t x = a[i];
+      int64_t y = b[i];
+      d += x > y ? x - y : y - x;
+      sa += x;
+      sb += y;
+      saa += x * x;
+      sbb += y * y;
+      sab += x * y;
+    }
+    s.abs_diff = static_cast<double>(d);
+    s.a = static_cast<double>(sa);
+    s.b = static_cast<double>(sb);
+    s.aa = static_cast<double>(saa);
+    s.bb = static_cast<double>(sbb);
+    s.ab = static_cast<double>(sab);
+  } else {
+    for (size_t i = 0; i < n; ++i) {
+      double x = static_cast<double>(a[i]);
+      double y = static_cast<double>(b[i]);
+      s.abs_diff += x > y ? x - y : y - x;
+      s.a += x;
+      s.b += y;
+      s.aa += x * x;
+      s.bb += y * y;
+      s.ab += x * y;
+    }
+  }
+  return s;
+}
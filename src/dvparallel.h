@@ -0,0 +1,234 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+// Number of worker threads to use when the caller passes 0.
+unsigned defaultThreadCount() {
+  unsigned n = std::thread::hardware_concurrency();
+  return n ? n : 1;
+}
+
+// Run fn(i) for every i in [0, n) on up to `threads` threads (0 = one per core). Indices are handed
+// out in increasing order, so neighbouring sections are read at about the same time. The first
+// exception thrown by fn stops the remaining work and is rethrown on the calling thread.
+template <typename F>
+void parallelFor(size_t n, F&& fn, unsigned threads = 0) {
+  if (threads == 0) threads = defaultThreadCount();
+  threads = static_cast<unsigned>(std::min<size_t>(threads, n));
+  if (threads <= 1) {
+    for (size_t i = 0; i < n; ++i) fn(i);
+    return;
+  }
+
+  std::atomic<size_t> next{0};
+  std::atomic<bool> failed{false};
+  std::exception_ptr error;
+  std::mutex error_mutex;
+
+  auto worker = [&] {
+    while (!failed) {
+      size_t i = next++;
+      if (i >= n) break;
+      try {
+        fn(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error) error = std::current_exception();
+        failed = true;
+      }
+    }
+  };
+
+  std::vector<std::thread> pool;
+  pool.reserve(threads - 1);
+  for (unsigned i = 1; i < threads; ++i) pool.emplace_back(worker);
+  worker();
+  for (auto& th : pool) th.join();
+  if (error) std::rethrow_exception(error);
+}
+
+// Run fn(i, worker) for every i in [0, n) with work stealing. Each of the `threads` workers
+// (0 = one per core) starts on its own contiguous share of the range and walks it in order; a
+// worker that runs dry steals the back half of the largest remaining share. Neighbouring indices
+// (neighbouring sections on disk) therefore mostly stay on one thread, while uneven per-index
+// costs still balance out. `worker` is in [0, threads) and identifies per-worker state. The
+// first exception thrown by fn stops the remaining work and is rethrown on the calling thread.
+template <typename F>
+void parallelForStealing(size_t n, F&& fn, unsigned threads = 0) {
+  if (threads == 0) threads = defaultThreadCount();
+  threads = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(threads, n)));
+  if (n > UINT32_MAX) {
+    throw std::runtime_error("parallelForStealing supports at most 2^32 - 1 indices");
+  }
+  if (threads == 1) {
+    for (size_t i = 0; i < n; ++i) fn(i, 0u);
+    return;
+  }
+
+  // [begin, end) of each worker packed as begin << 32 | end, updated with CAS only
+  struct alignas(64) Share {
+    std::atomic<uint64_t> bounds{0};
+  };
+  std::vector<Share> shares(threads);
+  for (unsigned w = 0; w < threads; ++w) {
+    uint64_t begin = n * w / threads, end = n * (w + 1) / threads;
+    shares[w].bounds.store(begin << 32 | end);
+  }
+  std::atomic<bool> failed{false};
+  std::exception_ptr error;
+  std::mutex error_mutex;
+
+  auto takeFront = [&](unsigned w, size_t& i) {
+    std::atomic<uint64_t>& bounds = shares[w].bounds;
+    uint64_t old = bounds.load();
+    while (true) {
+      uint64_t begin = old >> 32, end = old & 0xFFFFFFFFu;
+      if (begin >= end) return false;
+      if (bounds.compare_exchange_weak(old, (begin + 1) << 32 | end)) {
+        i = begin;
+        return true;
+      }
+    }
+  };
+
+  auto steal = [&](unsigned thief) {
+    while (true) {
+      unsigned victim = thief;
+      uint64_t most = 0;
+      for (unsigned w = 0; w < threads; ++w) {
+        uint64_t b = shares[w].bounds.load();
+        uint64_t left = (b >> 32) < (b & 0xFFFFFFFFu) ? (b & 0xFFFFFFFFu) - (b >> 32) : 0;
+        if (w != thief && left > most) {
+          most = left;
+          victim = w;
+        }
+      }
+      if (most == 0) return false;
+      std::atomic<uint64_t>& bounds = shares[victim].bounds;
+      uint64_t old = bounds.load();
+      uint64_t begin = old >> 32, end = old & 0xFFFFFFFFu;
+      if (begin >= end) continue;
+      uint64_t half = (end - begin + 1) / 2;
+      if (bounds.compare_exchange_strong(old, begin << 32 | (end - half))) {
+        shares[thief].bounds.store((end - half) << 32 | end);
+        return true;
+      }
+    }
+  };
+
+  auto worker = [&](unsigned w) {
+    size_t i;
+    while (!failed) {
+      if (!takeFront(w, i)) {
+        if (!steal(w)) break;
+        continue;
+      }
+      try {
+        fn(i, w);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error) error = std::current_exception();
+        failed = true;
+      }
+    }
+  };
+
+  std::vector<std::thread> pool;
+  pool.reserve(threads - 1);
+  for (unsigned w = 1; w < threads; ++w) pool.emplace_back(worker, w);
+  worker(0);
+  for (auto& th : pool) th.join();
+  if (error) std::rethrow_exception(error);
+}
+
+// Fixed set of worker threads draining a bounded FIFO of tasks. submit() blocks while the queue
+// is full, which keeps a fast producer (usually the thread reading the file) from running ahead
+// of the workers and holding an unbounded number of sections in memory.
+class ThreadPool {
+ private:
+  std::vector<std::thread> _workers;
+  std::deque<std::function<void()>> _tasks;
+  size_t _max_queued;
+  size_t _running = 0;
+  bool _stop = false;
+  std::exception_ptr _error;
+  std::mutex _mutex;
+  std::condition_variable _cv;
+
+  void _run() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+      _cv.wait(lock, [&] { return _stop || !_tasks.empty(); });
+      if (_tasks.empty()) return;
+      std::function<void()> task = std::move(_tasks.front());
+      _tasks.pop_front();
+      _running++;
+      _cv.notify_all();
+      lock.unlock();
+      try {
+        task();
+      } catch (...) {
+        lock.lock();
+        if (!_error) _error = std::current_exception();
+        _tasks.clear();  // don't start anything else after a failure
+        lock.unlock();
+      }
+      lock.lock();
+      _running--;
+      _cv.notify_all();
+    }
+  }
+
+ public:
+  // max_queued = 0 queues up to two tasks per worker
+  explicit ThreadPool(unsigned threads = 0, size_t max_queued = 0) {
+    if (threads == 0) threads = defaultThreadCount();
+    _max_queued = max_queued ? max_queued : 2 * threads;
+    _workers.reserve(threads);
+    for (unsigned i = 0; i < threads; ++i) _workers.emplace_back(&ThreadPool::_run, this);
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+    }
+    _cv.notify_all();
+    for (auto& th : _workers) th.join();
+  }
+
+  size_t size() const { return _workers.size(); }
+
+  // Queue a task, blocking while the queue is full. Rethrows an earlier task's exception.
+  void submit(std::function<void()> task) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cv.wait(lock, [&] { return _error || _tasks.size() < _max_queued; });
+    if (_error) std::rethrow_exception(_error);
+    _tasks.push_back(std::move(task));
+    _cv.notify_all();
+  }
+
+  // Block until every submitted task has finished; rethrows the first exception any task threw.
+  void wait() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cv.wait(lock, [&] { return _tasks.empty() && _running == 0; });
+    if (_error) {
+      std::exception_ptr error = _error;
+      _error = nullptr;
+      std::rethrow_exception(error);
+    }
+  }
+};
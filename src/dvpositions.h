@@ -0,0 +1,161 @@
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "dvfile.h"
+#include "dvparallel.h"
+
+// Multi-position (file_type 20) acquisitions store every stage position as its own run of
+// planes: the Z axis of the file holds positions * planes_per_position sections per (t, w), with
+// each position's Z stack contiguous. Positions are told apart by the stage X/Y coordinates in
+// the per-section extended header records.
+
+struct StagePosition {
+  float x, y;       // stage coordinates of the position's first plane
+  int first_plane;  // file plane holding the position's z = 0
+};
+
+// Index of the stage X coordinate in a section record's floats; Y and Z follow.
+constexpr int kStageXFloat = 2;
+
+class MultiPositionFile {
+ private:
+  DVFile _file;
+  std::vector<StagePosition> _positions;
+  int _planes = 1;  // per position
+
+ public:
+  /**
+   * Open `path` and find its positions: runs of consecutive planes (at t = 0, w = 0) with the same
+   * stage X/Y, to within `tolerance`. Only multi-position files (file_type 20) are split; any
+   * other file, like one without per-section records or with the same stage position throughout,
+   * has a single position.
+   */
+  explicit MultiPositionFile(const std::string& path, float tolerance = 0.01f) : _file(path) {
+    const IW_MRC_Header& hdr = _file.header();
+    const int nz = hdr.num_planes();
+    // stage X/Y jitters along an ordinary Z stack, so it only marks positions in type 20 files
+    if (hdr.file_type != 20 || !_file.hasSectionRecords() || hdr.nreal < kStageXFloat + 2) {
+      _positions.push_back({0, 0, 0});
+      _planes = nz;
+      return;
+    }
+    std::vector<float> floats(hdr.nreal);
+    for (int z = 0; z < nz; ++z) {
+      _file.readSectionRecord(0, 0, z, nullptr, floats.data());
+      const float x = floats[kStageXFloat];
+      const float y = floats[kStageXFloat + 1];
+      if (_positions.empty() || std::fabs(x - _positions.back().x) > tolerance ||
+          std::fabs(y - _positions.back().y) > tolerance) {
+        _positions.push_back({x, y, z});
+      }
+    }
+    _planes = nz / static_cast<int>(_positions.size());
+    for (size_t p = 0; p < _positions.size(); ++p) {
+      if (_positions[p].first_plane != static_cast<int>(p) * _planes) {
+        throw std::runtime_error("Positions have different numbers of planes");
+      }
+    }
+  }
+
+  int numPositions() const { return static_cast<int>(_positions.size()); }
+
+  int planesPerPosition() const { return _planes; }
+
+  const StagePosition& position(int p) const { return _positions.at(p); }
+
+  // Header of position p on its own.
+  IW_MRC_Header positionHeader() const {
+    IW_MRC_Header h = _file.header();
+    const int nw = h.num_waves ? h.num_waves : 1;
+    const int nt = h.num_times ? h.num_times : 1;
+    h.nz = _planes * nw * nt;
+    if (h.file_type == 20) h.file_type = 0;
+    return h;
+  }
+
+  // File plane of plane z of position p.
+  int filePlane(int p, int z) const {
+    if (p < 0 || p >= numPositions() || z < 0 || z >= _planes) {
+      throw std::runtime_error("Position index out of range");
+    }
+    return _positions[p].first_plane + z;
+  }
+
+  // Read plane z of position p at (t, w). Safe to call from several threads.
+  void readSec(void* array, int p, int t, int w, int z) const {
+    _file.readSecAt(array, t, w, filePlane(p, z));
+  }
+
+  const DVFile& file() const { return _file; }
+};
+
+/**
+ * @brief Write every position of a multi-position file to its own DV file.
+ *
+ * Outputs are named <stem>_P<n>.dv in `out_dir` (n counting from 1) and keep the source's
+ * interleave (ZWT when the source is ZTW, so timepoints can be appended), pixel type and the
+ * matching per-section extended header records. Each position is written by one worker through
+ * a DVWriter, so output goes out in large sequential batches; positions are spread over
+ * `threads` workers (0 = one per core).
+ *
+ * @return The paths written, in position order.
+ */
+std::vector<std::string> splitPositions(const std::string& path, const std::string& out_dir,
+                                        unsigned threads = 0) {
+  MultiPositionFile src(path);
+  const DVFile& file = src.file();
+  const IW_MRC_Header& shdr = file.header();
+  IW_MRC_Header hdr = src.positionHeader();
+  if (hdr.interleaved == 0 && hdr.num_waves > 1) hdr.interleaved = 2;
+  const bool records = file.hasSectionRecords();
+  const size_t record_values = records ? static_cast<size_t>(shdr.nint + shdr.nreal) : 0;
+  hdr.inbsym = static_cast<int32_t>(4 * record_values * hdr.nz);
+  if (!records) {
+    hdr.nint = 0;
+    hdr.nreal = 0;
+  }
+
+  std::filesystem::create_directories(out_dir);
+  const std::string stem = std::filesystem::path(path).stem().string();
+  std::vector<std::string> outputs(src.numPositions());
+  for (int p = 0; p < src.numPositions(); ++p) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "_P%d.dv", p + 1);
+    outputs[p] = (std::filesystem::path(out_dir) / (stem + name)).string();
+  }
+
+  parallelFor(
+      outputs.size(),
+      [&](size_t p) {
+        const int pos = static_cast<int>(p);
+        DVWriter writer(outputs[p], hdr);
+        if (records) {
+          std::vector<int32_t> ext(record_values * hdr.nz);
+          for (int i = 0; i < hdr.nz; ++i) {
+            int t, w, z;
+            hdr.section_zwt(i, t, w, z);
+            int32_t* rec = ext.data() + i * record_values;
+            file.readSectionRecord(t, w, src.filePlane(pos, z), rec,
+                                   reinterpret_cast<float*>(rec + shdr.nint));
+          }
+          writer.setExtendedHeader(ext.data(), ext.size() * 4);
+        }
+        std::vector<char> plane(file.frameSize());
+        for (int i = 0; i < hdr.nz; ++i) {
+          int t, w, z;
+          hdr.section_zwt(i, t, w, z);
+          src.readSec(plane.data(), pos, t, w, z);
+          writer.writeSec(plane.data());
+        }
+        writer.close();
+      },
+      threads);
+  return outputs;
+}
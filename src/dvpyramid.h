@@ -0,0 +1,178 @@
+#pragma once
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "dvfile.h"
+#include "dvkernels.h"
+#include "dvparallel.h"
+
+// Default location of the sub-resolution sidecar for `path`.
+std::string pyramidSidecarPath(const std::string& path) { return path + ".pyramid.dv"; }
+
+/**
+ * @brief Build 2x-downsampled sub-resolution levels of a DV file.
+ *
+ * Each level halves X and Y (2x2 mean) and averages `zfactor` consecutive planes, computed from
+ * the level above it. Sections of a level are computed in parallel.
+ *
+ * With an empty `sidecar` the levels are appended after the full-resolution data and nres/nzfact
+ * are updated in the file's header. Otherwise they are written to a separate DV file whose base
+ * resolution is level 1 and whose own sub-resolutions are levels 2 and up.
+ *
+ * @param path The DV file to build levels for.
+ * @param levels The number of sub-resolution levels to build (not counting full resolution).
+ * @param zfactor The reduction factor for the Z axis at each level (nzfact).
+ * @param sidecar Where to write the levels, or empty to write them into `path`.
+ * @param threads The number of worker threads (0 = one per core).
+ */
+void buildPyramid(const std::string& path, int levels, int zfactor = 1,
+                  const std::string& sidecar = "", unsigned threads = 0) {
+  if (levels < 1) {
+    throw std::runtime_error("Pyramid needs at least one level");
+  }
+  if (zfactor < 1) zfactor = 1;
+
+  IW_MRC_Header hdr;
+  bool big_endian;
+  {
+    DVFile src(path);
+    hdr = src.getHeader();
+    big_endian = src.isBigEndian();
+  }
+  // levels keep the byte order of the source file
+  const bool swapped = big_endian != hostIsBigEndian();
+  PixelType mode = static_cast<PixelType>(hdr.mode);
+  if (isComplex(mode) || getPixelTypeSize(mode) == 0) {
+    throw std::runtime_error("Cannot build a pyramid for pixel mode " + std::to_string(hdr.mode));
+  }
+
+  // full layout, with levels 1..levels following the full-resolution data
+  IW_MRC_Header full = hdr;
+  full.nres = static_cast<int16_t>(levels + 1);
+  full.nzfact = static_cast<int16_t>(zfactor);
+
+  std::unique_ptr<PositionalFile> in = std::make_unique<PositionalFile>(path, sidecar.empty());
+  std::unique_ptr<PositionalFile> side;
+  IW_MRC_Header side_hdr;
+  if (!sidecar.empty()) {
+    side = std::make_unique<PositionalFile>(sidecar, true, true);
+    side_hdr = full.level_header(1);
+    side_hdr.nres = static_cast<int16_t>(levels);
+    side_hdr.nzfact = static_cast<int16_t>(zfactor);
+    side_hdr.inbsym = 0;
+    side_hdr.nint = 0;
+    side_hdr.nreal = 0;
+  }
+
+  // where level r lives: the file holding it and the offset of its first section
+  auto location = [&](int r) -> std::pair<const PositionalFile*, uint64_t> {
+    if (!side || r == 0) return {in.get(), full.level_offset(r)};
+    return {side.get(), side_hdr.level_offset(r - 1)};
+  };
+
+  const size_t pixel = getPixelTypeSize(mode);
+  const int nw = hdr.num_waves ? hdr.num_waves : 1;
+  const int nt = hdr.num_times ? hdr.num_times : 1;
+
+  for (int r = 1; r <= levels; ++r) {
+    const IW_MRC_Header src_hdr = full.level_header(r - 1);
+    const IW_MRC_Header dst_hdr = full.level_header(r);
+    auto src_loc = location(r - 1);
+    auto dst_loc = location(r);
+    const int fx = src_hdr.nx >= 2 ? 2 : 1;
+    const int fy = src_hdr.ny >= 2 ? 2 : 1;
+    const int src_planes = src_hdr.num_planes();
+    const int dst_planes = dst_hdr.num_planes();
+    const size_t src_frame = static_cast<size_t>(src_hdr.nx) * src_hdr.ny * pixel;
+    const size_t dst_pixels = static_cast<size_t>(dst_hdr.nx) * dst_hdr.ny;
+
+    parallelFor(
+        static_cast<size_t>(nt) * nw * dst_planes,
+        [&](size_t i) {
+          int z = static_cast<int>(i % dst_planes);
+          int w = static_cast<int>(i / dst_planes % nw);
+          int t = static_cast<int>(i / dst_planes / nw);
+          visitPixelType(mode, [&](auto tag) {
+            using T = typename decltype(tag)::type;
+            using A = accumulator_t<T>;
+            std::vector<T> plane(src_frame / sizeof(T));
+            std::vector<A> acc(dst_pixels, 0);
+            std::vector<T> out(dst_pixels);
+            int z0 = z * zfactor;
+            int z1 = std::min(z0 + zfactor, src_planes);
+            for (int zs = z0; zs < z1; ++zs) {
+              uint64_t offset = src_loc.second + src_hdr.section_index(t, w, zs) * src_frame;
+              src_loc.first->read(plane.data(), src_frame, offset);
+              if (swapped) swapBytes(plane.data(), src_frame, sizeof(T));
+              accumulateBlocks(plane.data(), src_hdr.nx, src_hdr.ny, fx, fy, acc.data());
+            }
+            storeMean(acc.data(), dst_pixels, static_cast<A>(fx * fy * (z1 - z0)), out.data());
+            if (swapped) swapBytes(out.data(), dst_pixels * pixel, sizeof(T));
+            uint64_t offset = dst_loc.second + dst_hdr.section_index(t, w, z) * dst_pixels * pixel;
+            dst_loc.first->write(out.data(), dst_pixels * pixel, offset);
+          });
+        },
+        threads);
+  }
+
+  char raw[sizeof(IW_MRC_Header)];
+  encodeHeader(side ? side_hdr : full, big_endian, raw);
+  (side ? side : in)->write(raw, sizeof(IW_MRC_Header), 0);
+}
+
+// Reads a DV file at any of its resolution levels, whether they are stored in the file itself or
+// in a sidecar produced by buildPyramid.
+class DVPyramid {
+ private:
+  DVFile _file;
+  std::unique_ptr<DVFile> _sidecar;
+
+ public:
+  explicit DVPyramid(const std::string& path, const std::string& sidecar = "") : _file(path) {
+    if (_file.numResolutions() > 1) return;
+    std::string side_path = sidecar.empty() ? pyramidSidecarPath(path) : sidecar;
+    if (sidecar.empty() && !std::ifstream(side_path).good()) return;
+
+    _sidecar = std::make_unique<DVFile>(side_path);
+    IW_MRC_Header expected = _file.getHeader();
+    expected.nres = 2;
+    expected.nzfact = _sidecar->getHeader().nzfact;
+    expected = expected.level_header(1);
+    IW_MRC_Header actual = _sidecar->getHeader();
+    if (actual.nx != expected.nx || actual.ny != expected.ny || actual.nz != expected.nz ||
+        actual.mode != expected.mode || actual.interleaved != expected.interleaved) {
+      throw std::runtime_error(side_path + " does not match " + path);
+    }
+  }
+
+  // number of resolution levels, including full resolution
+  int numLevels() const {
+    return _sidecar ? 1 + _sidecar->numResolutions() : _file.numResolutions();
+  }
+
+  IW_MRC_Header levelHeader(int level) const {
+    if (_sidecar && level > 0) return _sidecar->levelHeader(level - 1);
+    return _file.levelHeader(level);
+  }
+
+  void readSec(void* array, int t, int w, int z, int level) const {
+    if (_sidecar && level > 0) {
+      _sidecar->readSecAt(array, t, w, z, level - 1);
+    } else {
+      _file.readSecAt(array, t, w, z, level);
+    }
+  }
+
+  // Coarsest level that still has at least `scale` times the full-resolution pixel density in X
+  // and Y, e.g. 0.25 for a view showing the plane at a quarter of its size.
+  int levelForScale(double scale) const {
+    int level = 0;
+    while (level + 1 < numLevels() && scale <= 1.0 / (2 << level)) ++level;
+    return level;
+  }
+
+  DVFile& file() { return _file; }
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <type_traits>
+#include <vector>
+
+#include "dvfile.h"
+#include "dvparallel.h"
+
+// One section handed to forEachSection / transformSections callbacks.
+struct SectionRef {
+  int t, w, z;
+  size_t index;  // position in the file
+  const void* data;
+  int nx, ny;
+  PixelType type;
+
+  template <typename T>
+  const T* as() const {
+    return static_cast<const T*>(data);
+  }
+};
+
+/**
+ * @brief Call fn(const SectionRef&) for every section of `source`, in parallel.
+ *
+ * `source` is anything with getHeader(), frameSize() and a thread-safe readSecAt(array, t, w, z)
+ * (DVFile, DVCompressedFile, ...). Work is split with parallelForStealing over sections in file
+ * order: each worker reads its own contiguous run of the file with positional reads into a
+ * buffer it reuses, and idle workers steal the back half of another worker's run. fn may be
+ * called from several threads at once; the section data are only valid during the call.
+ *
+ * @param source The file to read.
+ * @param fn The function to apply.
+ * @param threads The number of worker threads (0 = one per core).
+ */
+template <typename Source, typename F>
+void forEachSection(const Source& source, F&& fn, unsigned threads = 0) {
+  const IW_MRC_Header hdr = source.getHeader();
+  const size_t n = static_cast<size_t>(hdr.nz);
+  if (threads == 0) threads = defaultThreadCount();
+  std::vector<std::vector<char>> buffers(threads);
+  parallelForStealing(
+      n,
+      [&](size_t i, unsigned worker) {
+        std::vector<char>& buffer = buffers[worker];
+        buffer.resize(source.frameSize());
+        SectionRef ref;
+        hdr.section_zwt(static_cast<int>(i), ref.t, ref.w, ref.z);
+        source.readSecAt(buffer.data(), ref.t, ref.w, ref.z);
+        ref.index = i;
+        ref.data = buffer.data();
+        ref.nx = hdr.nx;
+        ref.ny = hdr.ny;
+        ref.type = static_cast<PixelType>(hdr.mode);
+        fn(static_cast<const SectionRef&>(ref));
+      },
+      threads);
+}
+
+/**
+ * @brief Apply fn(const SectionRef&) -> R to every section of `source` in parallel and collect
+ * the results.
+ *
+ * Results are ordered by (t, w, z), i.e. result[(t * num_waves + w) * num_planes + z], whatever
+ * the file's interleave. See forEachSection for how work is scheduled. R must not be bool:
+ * std::vector<bool> packs results into shared words that the workers cannot write concurrently
+ * (use char or uint8_t instead).
+ */
+template <typename R, typename Source, typename F>
+std::vector<R> transformSections(const Source& source, F&& fn, unsigned threads = 0) {
+  static_assert(!std::is_same<R, bool>::value,
+                "transformSections<bool> would race on std::vector<bool>; use char");
+  const IW_MRC_Header hdr = source.getHeader();
+  const int nw = hdr.num_waves ? hdr.num_waves : 1;
+  const int np = hdr.num_planes();
+  std::vector<R> results(static_cast<size_t>(hdr.nz));
+  forEachSection(
+      source,
+      [&](const SectionRef& s) {
+        results[(static_cast<size_t>(s.t) * nw + s.w) * np + s.z] = fn(s);
+      },
+      threads);
+  return results;
+}
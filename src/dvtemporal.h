@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include "dvfile.h"
+#include "dvparallel.h"
+
+// How plane (w, z) changed between timepoints t - 1 and t.
+struct TemporalDelta {
+  int t, w, z;
+  double mean_abs_diff;
+  double correlation;  // Pearson; 1 if both planes are constant and equal, 0 if only one is
+};
+
+/**
+ * @brief Compare every plane with the same plane one timepoint earlier, e.g. to find drift,
+ * focus changes or stage jumps.
+ *
+ * Each (w, z) stack is walked in time order by one worker, which keeps the previous timepoint in
+ * a two-slot ring buffer, so every section is read exactly once. Stacks are spread over
+ * `threads` workers (0 = one per core), which parallelizes across wavelengths and planes.
+ * Complex data are compared component-wise.
+ *
+ * @return (num_times - 1) * num_waves * num_planes entries in (t, w, z) order, starting at t = 1.
+ */
+std::vector<TemporalDelta> temporalDeltaScan(const DVFile& file, unsigned threads = 0) {
+  const IW_MRC_Header& hdr = file.header();
+  const int nw = hdr.num_waves ? hdr.num_waves : 1;
+  const int nt = hdr.num_times ? hdr.num_times : 1;
+  const int nz = hdr.num_planes();
+  if (nt < 2) return {};
+  const size_t frame = file.frameSize();
+  const PixelType type = static_cast<PixelType>(hdr.mode);
+
+  std::vector<TemporalDelta> result(static_cast<size_t>(nt - 1) * nw * nz);
+  parallelFor(
+      static_cast<size_t>(nw) * nz,
+      [&](size_t stack) {
+        const int w = static_cast<int>(stack / nz);
+        const int z = static_cast<int>(stack % nz);
+        std::vector<char> ring[2] = {std::vector<char>(frame), std::vector<char>(frame)};
+        file.readSecAt(ring[0].data(), 0, w, z);
+        for (int t = 1; t < nt; ++t) {
+          const std::vector<char>& previous = ring[(t - 1) % 2];
+          std::vector<char>& current = ring[t % 2];
+          file.readSecAt(current.data(), t, w, z);
+          TemporalDelta& d = result[(static_cast<size_t>(t - 1) * nw + w) * nz + z];
+          d.t = t;
+          d.w = w;
+          d.z = z;
+          visitPixelType(type, [&](auto tag) {
+            using T = typename decltype(tag)::type;
+            const size_t n = frame / sizeof(T);
+            PairSums s = pairSums(reinterpret_cast<const T*>(previous.data()),
+                                  reinterpret_cast<const T*>(current.data()), n);
+            const double count = static_cast<double>(n);
+            d.mean_abs_diff = s.abs_diff / count;
+            const double va = count * s.aa - s.a * s.a;
+            const double vb = count * s.bb - s.b * s.b;
+            if (va > 0 && vb > 0) {
+              d.correlation = (count * s.ab - s.a * s.b) / std::sqrt(va * vb);
+            } else {
+              d.correlation = va <= 0 && vb <= 0 && s.abs_diff == 0 ? 1 : 0;
+            }
+          });
+        }
+      },
+      threads);
+  return result;
+}
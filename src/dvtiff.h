@@ -0,0 +1,286 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "dvfile.h"
+#include "dvparallel.h"
+
+struct TiffOptions {
+  int tile_size = 256;      // square tiles, rounded up to a multiple of 16 as TIFF requires
+  bool packbits = false;    // compress tiles with PackBits (TIFF compression 32773)
+  unsigned threads = 0;     // tile encoders (0 = one per core)
+  int batch_sections = 4;   // sections read, encoded and written per step
+};
+
+// PackBits-encode one row of bytes, appending to out.
+void packBitsEncode(const uint8_t* src, size_t n, std::vector<uint8_t>& out) {
+  size_t i = 0;
+  while (i < n) {
+    size_t run = 1;
+    while (i + run < n && run < 128 && src[i + run] == src[i]) ++run;
+    if (run >= 2) {
+      out.push_back(static_cast<uint8_t>(257 - run));  // -(run - 1)
+      out.push_back(src[i]);
+      i += run;
+      continue;
+    }
+    // literal stretch up to the next run of 2
+    size_t lit = 1;
+    while (i + lit < n && lit < 128 && !(i + lit + 1 < n && src[i + lit] == src[i + lit + 1])) {
+      ++lit;
+    }
+    out.push_back(static_cast<uint8_t>(lit - 1));
+    out.insert(out.end(), src + i, src + i + lit);
+    i += lit;
+  }
+}
+
+// Decode PackBits data into exactly `raw` bytes of dst.
+void packBitsDecode(const uint8_t* src, size_t n, uint8_t* dst, size_t raw) {
+  size_t i = 0, o = 0;
+  while (i < n && o < raw) {
+    int8_t h = static_cast<int8_t>(src[i++]);
+    if (h >= 0) {
+      size_t lit = static_cast<size_t>(h) + 1;
+      if (i + lit > n || o + lit > raw) break;
+      std::memcpy(dst + o, src + i, lit);
+      i += lit;
+      o += lit;
+    } else if (h != -128) {
+      size_t run = 1 - static_cast<int>(h);
+      if (i >= n || o + run > raw) break;
+      std::memset(dst + o, src[i++], run);
+      o += run;
+    }
+  }
+  if (o != raw) {
+    throw std::runtime_error("Corrupt PackBits data");
+  }
+}
+
+namespace bigtiff {
+
+const uint16_t SHORT = 3, LONG = 4, ASCII = 2, LONG8 = 16;
+
+// the file is written 'II' (little endian) whatever the host
+inline void put16(std::vector<uint8_t>& b, size_t at, uint16_t v) {
+  for (int i = 0; i < 2; ++i) b[at + i] = static_cast<uint8_t>(v >> (8 * i));
+}
+inline void put64(std::vector<uint8_t>& b, size_t at, uint64_t v) {
+  for (int i = 0; i < 8; ++i) b[at + i] = static_cast<uint8_t>(v >> (8 * i));
+}
+
+// One IFD entry. Values of up to 8 bytes are stored inline, anything longer at `offset`.
+struct Entry {
+  uint16_t tag, type;
+  uint64_t count;
+  uint64_t value;  // inline value or offset of the data
+};
+
+}  // namespace bigtiff
+
+// OME-XML for the ImageDescription of the first IFD; planes are stored in XYZCT order.
+std::string omeXml(const IW_MRC_Header& hdr, const std::string& name) {
+  const char* type = "uint16";
+  switch (static_cast<PixelType>(hdr.mode)) {
+    case PixelType::UINT8: type = "uint8"; break;
+    case PixelType::INT16:
+    case PixelType::INT16_ALT: type = "int16"; break;
+    case PixelType::INT32: type = "int32"; break;
+    case PixelType::FLOAT32: type = "float"; break;
+    default: break;
+  }
+  std::string safe;
+  for (char c : name) {
+    if (c == '<' || c == '>' || c == '&' || c == '"') c = '_';
+    safe += c;
+  }
+  std::ostringstream xml;
+  xml << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+      << "<OME xmlns=\"http://www.openmicroscopy.org/Schemas/OME/2016-06\">"
+      << "<Image ID=\"Image:0\" Name=\"" << safe << "\">"
+      << "<Pixels ID=\"Pixels:0\" DimensionOrder=\"XYZCT\" Type=\"" << type << "\""
+      << " SizeX=\"" << hdr.nx << "\" SizeY=\"" << hdr.ny << "\" SizeZ=\"" << hdr.num_planes()
+      << "\" SizeC=\"" << (hdr.num_waves ? hdr.num_waves : 1) << "\" SizeT=\""
+      << (hdr.num_times ? hdr.num_times : 1) << "\"";
+  if (hdr.xlen > 0) xml << " PhysicalSizeX=\"" << hdr.xlen << "\"";
+  if (hdr.ylen > 0) xml << " PhysicalSizeY=\"" << hdr.ylen << "\"";
+  if (hdr.zlen > 0) xml << " PhysicalSizeZ=\"" << hdr.zlen << "\"";
+  xml << ">";
+  for (int c = 0; c < (hdr.num_waves ? hdr.num_waves : 1); ++c) {
+    xml << "<Channel ID=\"Channel:0:" << c << "\" SamplesPerPixel=\"1\"/>";
+  }
+  xml << "<TiffData/></Pixels></Image></OME>";
+  return xml.str();
+}
+
+/**
+ * @brief Export a DV file as a tiled OME BigTIFF.
+ *
+ * Every (t, c, z) section becomes one IFD, in OME's XYZCT order. The IFDs and their tile
+ * offset/byte count arrays are laid out up front right after the file header; tile data follow
+ * in the order the sections are stored in the DV file, so both the reads and the writes are
+ * sequential. Sections are processed batch_sections at a time with their tiles encoded on a
+ * worker pool, so memory use stays at a few sections regardless of file size.
+ *
+ * @param path The DV file to read.
+ * @param tiff_path The BigTIFF file to write.
+ * @param options Tile size, compression, threads and batch size.
+ */
+void exportBigTiff(const std::string& path, const std::string& tiff_path,
+                   const TiffOptions& options = TiffOptions()) {
+  using namespace bigtiff;
+  DVFile src(path);
+  const IW_MRC_Header hdr = src.getHeader();
+  const PixelType type = static_cast<PixelType>(hdr.mode);
+  uint16_t sample_format = 1;
+  switch (type) {
+    case PixelType::UINT8:
+    case PixelType::UINT16: sample_format = 1; break;
+    case PixelType::INT16:
+    case PixelType::INT16_ALT:
+    case PixelType::INT32: sample_format = 2; break;
+    case PixelType::FLOAT32: sample_format = 3; break;
+    default: throw std::runtime_error("Pixel mode cannot be exported to TIFF");
+  }
+  const size_t pixel = src.getPixelSize();
+  const int tile = std::max(16, (options.tile_size + 15) / 16 * 16);
+  const int tiles_x = (hdr.nx + tile - 1) / tile;
+  const int tiles_y = (hdr.ny + tile - 1) / tile;
+  const size_t tiles = static_cast<size_t>(tiles_x) * tiles_y;
+  const size_t tile_bytes = static_cast<size_t>(tile) * tile * pixel;
+  const int nt = hdr.num_times ? hdr.num_times : 1;
+  const int nc = hdr.num_waves ? hdr.num_waves : 1;
+  const int nz = hdr.num_planes();
+  const size_t planes = static_cast<size_t>(nt) * nc * nz;
+  const std::string description = omeXml(hdr, std::filesystem::path(path).filename().string());
+
+  // IFD layout: count, entries, next offset, then the tile offset and byte count arrays
+  const size_t num_entries = 13;
+  const size_t ifd_bytes = 8 + num_entries * 20 + 8;
+  const size_t arrays_bytes = tiles > 1 ? 2 * tiles * 8 : 0;
+  const size_t block = ifd_bytes + arrays_bytes;
+  const uint64_t ifds_start = 16;
+  const uint64_t desc_offset = ifds_start + planes * block;
+  const uint64_t data_start = desc_offset + description.size() + 1;
+  std::vector<uint8_t> meta(data_start, 0);
+
+  // file header
+  meta[0] = 'I';
+  meta[1] = 'I';
+  put16(meta, 2, 43);
+  put16(meta, 4, 8);
+  put16(meta, 6, 0);
+  put64(meta, 8, ifds_start);
+  std::memcpy(&meta[desc_offset], description.c_str(), description.size() + 1);
+
+  auto ifdOffset = [&](size_t plane) { return ifds_start + plane * block; };
+  // where the tile offset/byte count values of a plane live (inline when there is one tile)
+  auto offsetsAt = [&](size_t plane) {
+    return tiles > 1 ? ifdOffset(plane) + ifd_bytes : ifdOffset(plane) + 8 + 10 * 20 + 12;
+  };
+  auto countsAt = [&](size_t plane) {
+    return tiles > 1 ? ifdOffset(plane) + ifd_bytes + tiles * 8
+                     : ifdOffset(plane) + 8 + 11 * 20 + 12;
+  };
+
+  for (size_t p = 0; p < planes; ++p) {
+    const uint64_t at = ifdOffset(p);
+    const Entry entries[num_entries] = {
+        {256, LONG, 1, static_cast<uint64_t>(hdr.nx)},
+        {257, LONG, 1, static_cast<uint64_t>(hdr.ny)},
+        {258, SHORT, 1, pixel * 8},
+        {259, SHORT, 1, options.packbits ? 32773u : 1u},
+        {262, SHORT, 1, 1},  // BlackIsZero
+        {270, ASCII, p == 0 ? description.size() + 1 : 1, p == 0 ? desc_offset : 0},
+        {277, SHORT, 1, 1},
+        {284, SHORT, 1, 1},
+        {322, SHORT, 1, static_cast<uint64_t>(tile)},
+        {323, SHORT, 1, static_cast<uint64_t>(tile)},
+        {324, LONG8, tiles, tiles > 1 ? offsetsAt(p) : 0},
+        {325, LONG8, tiles, tiles > 1 ? countsAt(p) : 0},
+        {339, SHORT, 1, sample_format},
+    };
+    put64(meta, at, num_entries);
+    for (size_t e = 0; e < num_entries; ++e) {
+      size_t eat = at + 8 + e * 20;
+      put16(meta, eat, entries[e].tag);
+      put16(meta, eat + 2, entries[e].type);
+      put64(meta, eat + 4, entries[e].count);
+      put64(meta, eat + 12, entries[e].value);
+    }
+    put64(meta, at + 8 + num_entries * 20, p + 1 < planes ? ifdOffset(p + 1) : 0);
+  }
+
+  // the metadata region is reserved in front of the data and written once the tile offsets and
+  // (compressed) sizes are known
+  PositionalFile out(tiff_path, true, true);
+  uint64_t offset = data_start;
+
+  // sections in file order, each mapped to its OME plane index
+  std::vector<std::pair<size_t, size_t>> order;  // (file index, plane)
+  order.reserve(planes);
+  for (int t = 0; t < nt; ++t) {
+    for (int c = 0; c < nc; ++c) {
+      for (int z = 0; z < nz; ++z) {
+        order.emplace_back(hdr.section_index(t, c, z), z + nz * (c + static_cast<size_t>(nc) * t));
+      }
+    }
+  }
+  std::sort(order.begin(), order.end());
+
+  const size_t batch = static_cast<size_t>(std::max(1, options.batch_sections));
+  std::vector<std::vector<uint8_t>> sections(batch);
+  std::vector<std::vector<uint8_t>> encoded(batch * tiles);
+  for (size_t first = 0; first < planes; first += batch) {
+    const size_t count = std::min(batch, planes - first);
+    for (size_t i = 0; i < count; ++i) {
+      sections[i].resize(src.frameSize());
+      src.readSecIndexAt(sections[i].data(), order[first + i].first);
+      if (hostIsBigEndian()) swapBytes(sections[i].data(), sections[i].size(), pixel);
+    }
+    parallelFor(
+        count * tiles,
+        [&](size_t job) {
+          const size_t i = job / tiles, c = job % tiles;
+          const int x0 = static_cast<int>(c % tiles_x) * tile;
+          const int y0 = static_cast<int>(c / tiles_x) * tile;
+          const int w = std::min(tile, hdr.nx - x0), h = std::min(tile, hdr.ny - y0);
+          std::vector<uint8_t> raw(tile_bytes, 0);  // edge tiles are padded with zeros
+          for (int y = 0; y < h; ++y) {
+            std::memcpy(&raw[static_cast<size_t>(y) * tile * pixel],
+                        &sections[i][(static_cast<size_t>(y0 + y) * hdr.nx + x0) * pixel],
+                        w * pixel);
+          }
+          if (!options.packbits) {
+            encoded[job] = std::move(raw);
+            return;
+          }
+          std::vector<uint8_t>& packed = encoded[job];
+          packed.clear();
+          for (int y = 0; y < tile; ++y) {
+            packBitsEncode(&raw[static_cast<size_t>(y) * tile * pixel], tile * pixel, packed);
+          }
+        },
+        options.threads);
+
+    std::vector<uint8_t> run;
+    for (size_t i = 0; i < count; ++i) {
+      const size_t plane = order[first + i].second;
+      for (size_t c = 0; c < tiles; ++c) {
+        const std::vector<uint8_t>& data = encoded[i * tiles + c];
+        put64(meta, offsetsAt(plane) + c * 8, offset + run.size());
+        put64(meta, countsAt(plane) + c * 8, data.size());
+        run.insert(run.end(), data.begin(), data.end());
+      }
+    }
+    out.write(run.data(), run.size(), offset);
+    offset += run.size();
+  }
+  out.write(meta.data(), meta.size(), 0);
+}
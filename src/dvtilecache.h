@@ -0,0 +1,170 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "dvfile.h"
+
+struct TileCacheOptions {
+  int tile_size = 256;            // tiles are tile_size x tile_size pixels (smaller at the edges)
+  size_t max_bytes = 256 << 20;  // least recently used tiles are dropped beyond this
+};
+
+/**
+ * @brief Serves viewport requests on a DVFile from a cache of fixed-size tiles.
+ *
+ * Each tile is stored as its own contiguous block, so a zoomed-in viewport only ever loads and
+ * copies the tiles it overlaps rather than whole planes. Missing tiles are filled with region
+ * reads on demand, and memory is bounded by dropping the least recently used tiles. All methods
+ * are safe to call from several threads; tiles are filled outside the lock.
+ */
+class TileCache {
+ private:
+  struct Tile {
+    uint64_t key;
+    int width, height;
+    std::vector<uint8_t> data;  // width * height pixels, row-major
+  };
+  using TilePtr = std::shared_ptr<const Tile>;
+
+  const DVFile& _file;
+  IW_MRC_Header _hdr;
+  TileCacheOptions _options;
+  size_t _pixel;
+  int _tiles_x, _tiles_y;
+  unsigned _nt, _nw, _np;  // header counts, 0 read as 1
+
+  mutable std::mutex _mutex;
+  std::list<TilePtr> _lru;  // most recently used first
+  std::unordered_map<uint64_t, std::list<TilePtr>::iterator> _index;
+  size_t _bytes = 0;
+  size_t _hits = 0;
+  size_t _misses = 0;
+
+  uint64_t _key(size_t section, int tx, int ty) const {
+    return (static_cast<uint64_t>(section) * _tiles_y + ty) * _tiles_x + tx;
+  }
+
+  TilePtr _tile(int t, int w, int z, int tx, int ty) {
+    const uint64_t key = _key(_hdr.section_index(t, w, z), tx, ty);
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      auto it = _index.find(key);
+      if (it != _index.end()) {
+        _lru.splice(_lru.begin(), _lru, it->second);
+        ++_hits;
+        return *it->second;
+      }
+      ++_misses;
+    }
+
+    auto tile = std::make_shared<Tile>();
+    tile->key = key;
+    const int x = tx * _options.tile_size;
+    const int y = ty * _options.tile_size;
+    tile->width = std::min(_options.tile_size, _hdr.nx - x);
+    tile->height = std::min(_options.tile_size, _hdr.ny - y);
+    tile->data.resize(static_cast<size_t>(tile->width) * tile->height * _pixel);
+    _file.readRegion(tile->data.data(), t, w, z, x, y, tile->width, tile->height);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _index.find(key);
+    if (it != _index.end()) return *it->second;  // another thread filled it first
+    _lru.push_front(tile);
+    _index[key] = _lru.begin();
+    _bytes += tile->data.size();
+    while (_bytes > _options.max_bytes && _lru.size() > 1) {
+      _bytes -= _lru.back()->data.size();
+      _index.erase(_lru.back()->key);
+      _lru.pop_back();
+    }
+    return tile;
+  }
+
+ public:
+  explicit TileCache(const DVFile& file, const TileCacheOptions& options = TileCacheOptions())
+      : _file(file), _hdr(file.getHeader()), _options(options), _pixel(file.getPixelSize()) {
+    if (_options.tile_size < 1) {
+      throw std::runtime_error("Tile size must be at least 1");
+    }
+    _nt = static_cast<unsigned>(_hdr.num_times ? _hdr.num_times : 1);
+    _nw = static_cast<unsigned>(_hdr.num_waves ? _hdr.num_waves : 1);
+    _np = static_cast<unsigned>(_hdr.num_planes());
+    _tiles_x = (_hdr.nx + _options.tile_size - 1) / _options.tile_size;
+    _tiles_y = (_hdr.ny + _options.tile_size - 1) / _options.tile_size;
+  }
+
+  TileCache(const TileCache&) = delete;
+  TileCache& operator=(const TileCache&) = delete;
+
+  /**
+   * Copy the width x height viewport at (x, y) of section (t, w, z) into `array` (row-major,
+   * `width` pixels per row), loading any tiles it overlaps that are not cached yet.
+   */
+  void readViewport(void* array, int t, int w, int z, int x, int y, int width, int height) {
+    // checked before any lookup: an out-of-range index can map onto another section's key
+    if (static_cast<unsigned>(t) >= _nt || static_cast<unsigned>(w) >= _nw ||
+        static_cast<unsigned>(z) >= _np) {
+      throw std::runtime_error("Section index out of range");
+    }
+    if (x < 0 || y < 0 || width < 0 || height < 0 || x + width > _hdr.nx ||
+        y + height > _hdr.ny) {
+      throw std::runtime_error("Viewport out of range");
+    }
+    if (width == 0 || height == 0) return;
+    const int ts = _options.tile_size;
+    uint8_t* out = static_cast<uint8_t*>(array);
+    const size_t out_stride = static_cast<size_t>(width) * _pixel;
+    for (int ty = y / ts; ty <= (y + height - 1) / ts; ++ty) {
+      for (int tx = x / ts; tx <= (x + width - 1) / ts; ++tx) {
+        TilePtr tile = _tile(t, w, z, tx, ty);
+        // overlap of the tile and the viewport, in image coordinates
+        const int x0 = std::max(x, tx * ts);
+        const int x1 = std::min(x + width, tx * ts + tile->width);
+        const int y0 = std::max(y, ty * ts);
+        const int y1 = std::min(y + height, ty * ts + tile->height);
+        const size_t span = static_cast<size_t>(x1 - x0) * _pixel;
+        const size_t tile_stride = static_cast<size_t>(tile->width) * _pixel;
+        for (int r = y0; r < y1; ++r) {
+          const uint8_t* src =
+              tile->data.data() + (r - ty * ts) * tile_stride + (x0 - tx * ts) * _pixel;
+          std::memcpy(out + (r - y) * out_stride + (x0 - x) * _pixel, src, span);
+        }
+      }
+    }
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _lru.clear();
+    _index.clear();
+    _bytes = 0;
+  }
+
+  size_t cachedBytes() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _bytes;
+  }
+
+  size_t cachedTiles() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _lru.size();
+  }
+
+  size_t hits() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _hits;
+  }
+
+  size_t misses() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _misses;
+  }
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "dvfile.h"
+#include "dvparallel.h"
+
+struct TranscodeOptions {
+  size_t buffer_bytes = 256 << 20;  // memory for sections between reading and writing
+  size_t write_chunk = 8 << 20;     // each writer's share of a block
+  unsigned threads = 0;             // readers and writers (0 = one per core)
+};
+
+/**
+ * @brief Rewrite a DV file with its sections in a different interleave order.
+ *
+ * The output is produced in blocks of as many sections as fit in half of
+ * `options.buffer_bytes`. For each block the needed source sections are sorted by position and
+ * read as contiguous runs into a staging buffer, copied into output order, and the block is
+ * written out sequentially in chunks by several writers. Memory stays bounded no matter how
+ * large the file is.
+ *
+ * Sections, the header and the per-section extended header records are copied in the source's
+ * byte order; the records are permuted along with the sections. Resolution levels stored after
+ * the data are dropped, since their layout follows the old order.
+ *
+ * @param interleaved The new order: 0 = ZTW, 1 = WZT, 2 = ZWT.
+ */
+void transcodeInterleave(const std::string& path, const std::string& out_path, int interleaved,
+                         const TranscodeOptions& options = TranscodeOptions()) {
+  if (interleaved < 0 || interleaved > 2) {
+    throw std::runtime_error("Unsupported interleave order: " + std::to_string(interleaved));
+  }
+  DVFile file(path);
+  const IW_MRC_Header src = file.header();
+  IW_MRC_Header dst = src;
+  dst.interleaved = static_cast<int16_t>(interleaved);
+  dst.nres = 1;
+  const size_t count = static_cast<size_t>(src.nz);
+  const size_t frame = file.frameSize();
+  const uint64_t data_offset = file.dataOffset();
+  const bool big_endian = file.isBigEndian();
+  const bool records = file.hasSectionRecords();
+  file.close();
+  if (frame == 0) {
+    throw std::runtime_error("Cannot transcode empty sections");
+  }
+
+  // source index of every output section
+  std::vector<size_t> source(count);
+  for (size_t i = 0; i < count; ++i) {
+    int t, w, z;
+    dst.section_zwt(static_cast<int>(i), t, w, z);
+    source[i] = static_cast<size_t>(src.section_index(t, w, z));
+  }
+
+  // opening the output truncates it, so it must not be the source under another name
+  std::error_code ec;
+  if (std::filesystem::equivalent(path, out_path, ec)) {
+    throw std::runtime_error("Cannot transcode " + path + " onto itself");
+  }
+  PositionalFile in(path);
+  PositionalFile out(out_path, true, true);
+
+  // header and extended header
+  std::vector<char> head(data_offset);
+  in.read(head.data(), head.size(), 0);
+  encodeHeader(dst, big_endian, head.data());
+  if (records) {
+    const size_t record = 4 * static_cast<size_t>(src.nint + src.nreal);
+    std::vector<char> permuted(record * count);
+    for (size_t i = 0; i < count; ++i) {
+      std::memcpy(permuted.data() + i * record, head.data() + 1024 + source[i] * record, record);
+    }
+    std::memcpy(head.data() + 1024, permuted.data(), permuted.size());
+  }
+  out.write(head.data(), head.size(), 0);
+
+  const unsigned threads = options.threads ? options.threads : defaultThreadCount();
+  // half the budget receives contiguous source runs, the other half the permuted block
+  const size_t block = std::max<size_t>(1, options.buffer_bytes / 2 / frame);
+  std::vector<char> staging(std::min(block, count) * frame);
+  std::vector<char> buffer(staging.size());
+
+  struct Run {
+    size_t first;   // first source section
+    size_t length;  // sections
+    size_t slot;    // staging slot of the first section
+  };
+  for (size_t b0 = 0; b0 < count; b0 += block) {
+    const size_t b1 = std::min(count, b0 + block);
+
+    // the block's sections sorted by source position, coalesced into contiguous runs
+    std::vector<size_t> order(b1 - b0);
+    for (size_t k = 0; k < order.size(); ++k) order[k] = k;
+    std::sort(order.begin(), order.end(),
+              [&](size_t a, size_t b) { return source[b0 + a] < source[b0 + b]; });
+    std::vector<Run> runs;
+    for (size_t j = 0; j < order.size(); ++j) {
+      const size_t s = source[b0 + order[j]];
+      if (!runs.empty() && runs.back().first + runs.back().length == s) {
+        ++runs.back().length;
+      } else {
+        runs.push_back({s, 1, j});
+      }
+    }
+
+    parallelFor(
+        runs.size(),
+        [&](size_t r) {
+          in.read(staging.data() + runs[r].slot * frame, runs[r].length * frame,
+                  data_offset + runs[r].first * frame);
+        },
+        threads);
+    for (size_t j = 0; j < order.size(); ++j) {
+      std::memcpy(buffer.data() + order[j] * frame, staging.data() + j * frame, frame);
+    }
+
+    const size_t bytes = (b1 - b0) * frame;
+    const size_t chunk = std::max<size_t>(frame, options.write_chunk / frame * frame);
+    parallelFor(
+        (bytes + chunk - 1) / chunk,
+        [&](size_t c) {
+          const size_t offset = c * chunk;
+          out.write(buffer.data() + offset, std::min(chunk, bytes - offset),
+                    data_offset + b0 * frame + offset);
+        },
+        threads);
+  }
+}
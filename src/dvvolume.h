@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "dvbuffers.h"
+#include "dvfile.h"
+#include "dvparallel.h"
+
+// A whole DV file in one aligned, contiguous array. The outer three axes are T, C (wavelength)
+// and Z in the order given by `order`, outermost first; Y and X are always innermost, so "TCZ"
+// is a TCZYX array.
+class Volume {
+ private:
+  void* _data = nullptr;
+  size_t _bytes = 0;
+  size_t _strides[3] = {0, 0, 0};  // in planes, for T, C and Z
+
+ public:
+  int nt = 0, nc = 0, nz = 0, ny = 0, nx = 0;
+  PixelType type = PixelType::UINT16;
+  std::string order;
+
+  Volume() = default;
+
+  Volume(int t, int c, int z, int y, int x, PixelType pixel_type, const std::string& axes,
+         size_t alignment = 4096)
+      : nt(t), nc(c), nz(z), ny(y), nx(x), type(pixel_type), order(axes) {
+    std::string sorted = order;
+    std::sort(sorted.begin(), sorted.end());
+    if (sorted != "CTZ") {
+      throw std::runtime_error("Volume order must be a permutation of T, C and Z: " + order);
+    }
+    const int extent[3] = {nt, nc, nz};
+    size_t stride = 1;
+    for (int k = 2; k >= 0; --k) {
+      const int axis = order[k] == 'T' ? 0 : order[k] == 'C' ? 1 : 2;
+      _strides[axis] = stride;
+      stride *= static_cast<size_t>(extent[axis]);
+    }
+    _bytes = stride * planeBytes();
+    if (_bytes > 0) _data = alignedAlloc(_bytes, alignment);
+  }
+
+  Volume(const Volume&) = delete;
+  Volume& operator=(const Volume&) = delete;
+  Volume(Volume&& other) noexcept { *this = std::move(other); }
+  Volume& operator=(Volume&& other) noexcept {
+    if (this != &other) {
+      if (_data) alignedFree(_data);
+      _data = other._data;
+      _bytes = other._bytes;
+      std::copy(other._strides, other._strides + 3, _strides);
+      nt = other.nt;
+      nc = other.nc;
+      nz = other.nz;
+      ny = other.ny;
+      nx = other.nx;
+      type = other.type;
+      order = std::move(other.order);
+      other._data = nullptr;
+      other._bytes = 0;
+    }
+    return *this;
+  }
+  ~Volume() {
+    if (_data) alignedFree(_data);
+  }
+
+  void* data() { return _data; }
+  const void* data() const { return _data; }
+
+  template <typename T>
+  T* as() {
+    return static_cast<T*>(_data);
+  }
+
+  size_t size() const { return _bytes; }
+
+  size_t planeBytes() const {
+    return static_cast<size_t>(nx) * ny * getPixelTypeSize(type);
+  }
+
+  // position of plane (t, c, z) in the array, in planes
+  size_t planeIndex(int t, int c, int z) const {
+    return t * _strides[0] + c * _strides[1] + z * _strides[2];
+  }
+
+  void* plane(int t, int c, int z) {
+    return static_cast<char*>(_data) + planeIndex(t, c, z) * planeBytes();
+  }
+};
+
+// Volume order matching a file's interleave, so loading in it is one contiguous read.
+std::string fileVolumeOrder(const IW_MRC_Header& hdr) {
+  switch (hdr.interleaved) {
+    case 0: return "CTZ";  // ZTW
+    case 1: return "TZC";  // WZT
+    default: return "TCZ";  // ZWT
+  }
+}
+
+/**
+ * @brief Load all of `file` into one contiguous, page-aligned array.
+ *
+ * Sections that are consecutive in the file and land in consecutive planes of the array are
+ * merged into runs, so when `order` matches the file's interleave (see fileVolumeOrder) the
+ * whole data block is a single run. Runs are cut into pieces of about `chunk_bytes` and read
+ * straight into place with parallel positional reads, so no copies are made.
+ *
+ * @param order The outer axes, outermost first: a permutation of "TCZ".
+ * @param threads The number of readers (0 = one per core).
+ */
+Volume loadVolume(const DVFile& file, const std::string& order = "TCZ", unsigned threads = 0,
+                  size_t chunk_bytes = 16 << 20) {
+  const IW_MRC_Header& hdr = file.header();
+  const int nw = hdr.num_waves ? hdr.num_waves : 1;
+  const int nt = hdr.num_times ? hdr.num_times : 1;
+  Volume volume(nt, nw, hdr.num_planes(), hdr.ny, hdr.nx, static_cast<PixelType>(hdr.mode),
+                order);
+  const size_t count = static_cast<size_t>(hdr.nz);
+  const size_t frame = file.frameSize();
+  if (count == 0 || frame == 0) return volume;
+
+  struct Run {
+    size_t first;  // file section
+    size_t count;
+    size_t plane;  // destination plane
+  };
+  std::vector<Run> runs;
+  const size_t per_chunk = std::max<size_t>(1, chunk_bytes / frame);
+  for (size_t i = 0; i < count; ++i) {
+    int t, w, z;
+    hdr.section_zwt(static_cast<int>(i), t, w, z);
+    const size_t plane = volume.planeIndex(t, w, z);
+    if (!runs.empty()) {
+      Run& last = runs.back();
+      if (last.plane + last.count == plane && last.count < per_chunk) {
+        ++last.count;
+        continue;
+      }
+    }
+    runs.push_back({i, 1, plane});
+  }
+
+  char* base = static_cast<char*>(volume.data());
+  parallelFor(
+      runs.size(),
+      [&](size_t r) {
+        file.readSectionsAt(base + runs[r].plane * frame, runs[r].first, runs[r].count);
+      },
+      threads);
+  return volume;
+}
+
+Volume loadVolume(const std::string& path, const std::string& order = "TCZ",
+                  unsigned threads = 0) {
+  return loadVolume(DVFile(path), order, threads);
+}
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "dvfile.h"
+#include "dvparallel.h"
+
+struct ZarrOptions {
+  // chunk shape along Z, Y and X; 0 means the full extent of that axis
+  int chunk_z = 1;
+  int chunk_y = 0;
+  int chunk_x = 0;
+  unsigned threads = 0;                  // chunk writers (0 = one per core)
+  size_t max_inflight_bytes = 256 << 20;  // sections read but not yet written
+};
+
+// numpy dtype string of a pixel type, in native byte order
+std::string zarrDtype(PixelType type) {
+  uint16_t probe = 1;
+  const char order = *reinterpret_cast<uint8_t*>(&probe) ? '<' : '>';
+  switch (type) {
+    case PixelType::UINT8: return "|u1";
+    case PixelType::INT16:
+    case PixelType::INT16_ALT: return std::string(1, order) + "i2";
+    case PixelType::UINT16: return std::string(1, order) + "u2";
+    case PixelType::INT32: return std::string(1, order) + "i4";
+    case PixelType::FLOAT32: return std::string(1, order) + "f4";
+    case PixelType::COMPLEX64: return std::string(1, order) + "c8";
+    default: throw std::runtime_error("Pixel mode has no Zarr equivalent");
+  }
+}
+
+void writeTextFile(const std::filesystem::path& path, const std::string& text) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out << text;
+  if (!out) {
+    throw std::runtime_error("Failed to write " + path.string());
+  }
+}
+
+// `text` as the body of a JSON string literal
+std::string jsonEscape(const std::string& text) {
+  std::string out;
+  out.reserve(text.size());
+  for (char ch : text) {
+    switch (ch) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        if (static_cast<unsigned char>(ch) < 0x20) {
+          char escaped[8];
+          std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(ch));
+          out += escaped;
+        } else {
+          out += ch;
+        }
+    }
+  }
+  return out;
+}
+
+/**
+ * @brief Convert a DV file to an OME-Zarr (NGFF 0.4, Zarr v2) directory store.
+ *
+ * The image is written as a single TCZYX array "0" with uncompressed chunks of shape
+ * (1, 1, chunk_z, chunk_y, chunk_x). The calling thread reads chunk_z sections of one (t, c) at
+ * a time, visiting them in file order whatever the interleave, and a pool of workers cuts them
+ * into chunks and writes the chunk files. At most max_inflight_bytes of sections are held in
+ * memory at once, counting the block being read and those queued for or held by the workers;
+ * budgets below (threads + 2) blocks are rounded up to that.
+ *
+ * @param path The DV file to read.
+ * @param zarr_path The directory to create.
+ * @param options Chunk shape, thread count and memory bound.
+ */
+void convertToZarr(const std::string& path, const std::string& zarr_path,
+                   const ZarrOptions& options = ZarrOptions()) {
+  namespace fs = std::filesystem;
+  DVFile src(path);
+  const IW_MRC_Header hdr = src.getHeader();
+  const PixelType type = static_cast<PixelType>(hdr.mode);
+  const std::string dtype = zarrDtype(type);
+  const int nt = hdr.num_times ? hdr.num_times : 1;
+  const int nc = hdr.num_waves ? hdr.num_waves : 1;
+  const int nz = hdr.num_planes();
+  const int cz = options.chunk_z > 0 ? std::min(options.chunk_z, nz) : nz;
+  const int cy = options.chunk_y > 0 ? std::min(options.chunk_y, hdr.ny) : hdr.ny;
+  const int cx = options.chunk_x > 0 ? std::min(options.chunk_x, hdr.nx) : hdr.nx;
+  const int zblocks = (nz + cz - 1) / cz;
+  const int yblocks = (hdr.ny + cy - 1) / cy;
+  const int xblocks = (hdr.nx + cx - 1) / cx;
+  const size_t pixel = src.getPixelSize();
+  const size_t frame = src.frameSize();
+
+  const fs::path root(zarr_path);
+  fs::create_directories(root / "0");
+  writeTextFile(root / ".zgroup", "{\n  \"zarr_format\": 2\n}\n");
+
+  std::ostringstream attrs;
+  attrs << "{\n  \"multiscales\": [\n    {\n      \"version\": \"0.4\",\n"
+        << "      \"name\": \"" << jsonEscape(fs::path(path).filename().string()) << "\",\n"
+        << "      \"axes\": [\n"
+        << "        {\"name\": \"t\", \"type\": \"time\"},\n"
+        << "        {\"name\": \"c\", \"type\": \"channel\"},\n"
+        << "        {\"name\": \"z\", \"type\": \"space\", \"unit\": \"micrometer\"},\n"
+        << "        {\"name\": \"y\", \"type\": \"space\", \"unit\": \"micrometer\"},\n"
+        << "        {\"name\": \"x\", \"type\": \"space\", \"unit\": \"micrometer\"}\n"
+        << "      ],\n"
+        << "      \"datasets\": [\n        {\n          \"path\": \"0\",\n"
+        << "          \"coordinateTransformations\": [\n"
+        << "            {\"type\": \"scale\", \"scale\": [1.0, 1.0, "
+        << (hdr.zlen > 0 ? hdr.zlen : 1.0f) << ", " << (hdr.ylen > 0 ? hdr.ylen : 1.0f) << ", "
+        << (hdr.xlen > 0 ? hdr.xlen : 1.0f) << "]}\n"
+        << "          ]\n        }\n      ]\n    }\n  ]\n}\n";
+  writeTextFile(root / ".zattrs", attrs.str());
+
+  std::ostringstream zarray;
+  zarray << "{\n  \"zarr_format\": 2,\n"
+         << "  \"shape\": [" << nt << ", " << nc << ", " << nz << ", " << hdr.ny << ", " << hdr.nx
+         << "],\n"
+         << "  \"chunks\": [1, 1, " << cz << ", " << cy << ", " << cx << "],\n"
+         << "  \"dtype\": \"" << dtype << "\",\n"
+         << "  \"compressor\": null,\n  \"fill_value\": 0,\n  \"order\": \"C\",\n"
+         << "  \"filters\": null,\n  \"dimension_separator\": \"/\"\n}\n";
+  writeTextFile(root / "0" / ".zarray", zarray.str());
+
+  // one unit = chunk_z sections of one (t, c); visit units in the order they appear in the file
+  struct Unit {
+    int t, c, zb;
+    uint64_t offset;
+  };
+  std::vector<Unit> units;
+  units.reserve(static_cast<size_t>(nt) * nc * zblocks);
+  for (int t = 0; t < nt; ++t) {
+    for (int c = 0; c < nc; ++c) {
+      for (int zb = 0; zb < zblocks; ++zb) {
+        units.push_back({t, c, zb, src.sectionOffset(t, c, zb * cz)});
+      }
+    }
+  }
+  std::stable_sort(units.begin(), units.end(),
+                   [](const Unit& a, const Unit& b) { return a.offset < b.offset; });
+
+  const size_t unit_bytes = static_cast<size_t>(cz) * frame;
+  // the budget covers the block being read and one per running worker as well as the queue
+  const unsigned threads = options.threads ? options.threads : defaultThreadCount();
+  const size_t budget = options.max_inflight_bytes / unit_bytes;
+  const size_t max_queued = budget > threads + 2 ? budget - threads - 1 : 1;
+  ThreadPool pool(threads, max_queued);
+  for (const Unit& u : units) {
+    auto block = std::make_shared<std::vector<char>>(unit_bytes, 0);
+    int planes = std::min(cz, nz - u.zb * cz);
+    for (int z = 0; z < planes; ++z) {
+      src.readSecAt(block->data() + z * frame, u.t, u.c, u.zb * cz + z);
+    }
+    fs::path dir = root / "0" / std::to_string(u.t) / std::to_string(u.c) / std::to_string(u.zb);
+    pool.submit([=, &hdr] {
+      std::vector<char> chunk(static_cast<size_t>(cz) * cy * cx * pixel);
+      for (int yb = 0; yb < yblocks; ++yb) {
+        fs::create_directories(dir / std::to_string(yb));
+        int rows = std::min(cy, hdr.ny - yb * cy);
+        for (int xb = 0; xb < xblocks; ++xb) {
+          int cols = std::min(cx, hdr.nx - xb * cx);
+          // edge chunks keep the full chunk shape, padded with the fill value
+          std::fill(chunk.begin(), chunk.end(), 0);
+          for (int z = 0; z < cz; ++z) {
+            for (int y = 0; y < rows; ++y) {
+              const char* from = block->data() + z * frame +
+                                 ((static_cast<size_t>(yb) * cy + y) * hdr.nx + xb * cx) * pixel;
+              char* to = chunk.data() + ((static_cast<size_t>(z) * cy + y) * cx) * pixel;
+              std::memcpy(to, from, cols * pixel);
+            }
+          }
+          std::ofstream out(dir / std::to_string(yb) / std::to_string(xb),
+                            std::ios::binary | std::ios::trunc);
+          out.write(chunk.data(), chunk.size());
+          if (!out) {
+            throw std::runtime_error("Failed to write chunk in " + dir.string());
+          }
+        }
+      }
+    });
+  }
+  pool.wait();
+}
@@ -0,0 +1,100 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <coroutine>
+#include <latch>
+#include <vector>
+
+#include "dvasync.h"
+
+namespace {
+
+// starts immediately and cleans itself up when it finishes
+struct Detached {
+  struct promise_type {
+    Detached get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+Detached readFirstPixel(const AsyncDVFile& file, int t, int w, int z, uint16_t* out,
+                        std::latch* done) {
+  std::vector<uint16_t> buffer(file.frameSize() / sizeof(uint16_t));
+  co_await file.read_section(t, w, z, buffer.data());
+  *out = buffer[0];
+  done->count_down();
+}
+
+Detached readOutOfRange(const AsyncDVFile& file, bool* threw, std::latch* done) {
+  std::vector<uint16_t> buffer(file.frameSize() / sizeof(uint16_t));
+  try {
+    co_await file.read_section(5, 0, 0, buffer.data());
+  } catch (const std::runtime_error&) {
+    *threw = true;
+  }
+  done->count_down();
+}
+
+}  // namespace
+
+TEST(DVAsyncTest, ManyConcurrentReads) {
+  AsyncIOEngine engine(4);
+  AsyncDVFile file("example.dv", engine);
+  IW_MRC_Header hdr = file.getHeader();
+
+  const int rounds = 100;
+  std::vector<uint16_t> pixels(rounds * hdr.nz);
+  std::latch done(rounds * hdr.nz);
+  for (int r = 0; r < rounds; ++r) {
+    for (int i = 0; i < hdr.nz; ++i) {
+      int t = i / 9, w = i / 3 % 3, z = i % 3;
+      readFirstPixel(file, t, w, z, &pixels[r * hdr.nz + i], &done);
+    }
+  }
+  done.wait();
+
+  DVFile sync("example.dv");
+  std::vector<uint16_t> plane(hdr.nx * hdr.ny);
+  for (int i = 0; i < hdr.nz; ++i) {
+    sync.readSecAt(plane.data(), i / 9, i / 3 % 3, i % 3);
+    for (int r = 0; r < rounds; ++r) ASSERT_EQ(pixels[r * hdr.nz + i], plane[0]);
+  }
+
+  bool threw = false;
+  std::latch failed(1);
+  readOutOfRange(file, &threw, &failed);
+  failed.wait();
+  EXPECT_TRUE(threw);
+}
+
+TEST(DVAsyncTest, ReadsOutliveTheFile) {
+  AsyncIOEngine engine(1);
+  // hold the only I/O thread so the reads below are still queued when the file goes away
+  std::latch release(1);
+  engine.submit([](void* latch) { static_cast<std::latch*>(latch)->wait(); }, &release);
+
+  const int reads = 8;
+  std::vector<uint16_t> pixels(reads);
+  std::latch done(reads);
+  {
+    AsyncDVFile file("example.dv", engine);
+    for (int i = 0; i < reads; ++i) readFirstPixel(file, 0, 0, i % 3, &pixels[i], &done);
+  }
+  release.count_down();
+  done.wait();
+
+  DVFile sync("example.dv");
+  std::vector<uint16_t> plane(32 * 32);
+  for (int i = 0; i < reads; ++i) {
+    sync.readSecAt(plane.data(), 0, 0, i % 3);
+    EXPECT_EQ(pixels[i], plane[0]);
+  }
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
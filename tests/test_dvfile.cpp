@@ -1,8 +1,43 @@
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <stdexcept>
 
+#include "dvbuffers.h"
+#include "dvchecksum.h"
+#include "dvcompare.h"
+#include "dvcompress.h"
 #include "dvfile.h"
+#include "dvfile_c.h"
+#include "dvhistogram.h"
+#include "dvpositions.h"
+#include "dvpyramid.h"
+#include "dvsections.h"
+#include "dvtemporal.h"
+#include "dvtiff.h"
+#include "dvtilecache.h"
+#include "dvtranscode.h"
+#include "dvvolume.h"
+#include "dvzarr.h"
+
+namespace {
+
+void copyFile(const std::string& from, const std::string& to) {
+  std::ifstream src(from, std::ios::binary);
+  std::ofstream dst(to, std::ios::binary | std::ios::trunc);
+  dst << src.rdbuf();
+}
+
+// mean of the 2x2 block at (x, y) of a level-0 plane, rounded like storeMean
+uint16_t blockMean(const std::vector<uint16_t>& plane, int nx, int x, int y) {
+  uint32_t sum = plane[2 * y * nx + 2 * x] + plane[2 * y * nx + 2 * x + 1] +
+                 plane[(2 * y + 1) * nx + 2 * x] + plane[(2 * y + 1) * nx + 2 * x + 1];
+  return static_cast<uint16_t>((sum + 2) / 4);
+}
+
+}  // namespace
 
 TEST(DVFileTest, ReadHeader) {
   const int istream_no = 1;
@@ -70,6 +105,1186 @@ TEST(DVFileTest, ReadSection) {
   IMClose(istream_no);
 }
 
+TEST(DVFileTest, WriteStream) {
+  const int in_stream = 1;
+  const int out_stream = 2;
+  IW_MRC_HEADER hdr;
+
+  ASSERT_EQ(IMOpen(in_stream, "example.dv", "ro"), 0);
+  IMGetHdr(in_stream, &hdr);
+  ASSERT_EQ(IMOpen(out_stream, "written.dv", "new"), 0);
+  IMPutHdr(out_stream, &hdr);
+
+  std::vector<uint16_t> buffer(hdr.nx * hdr.ny, 0);
+  IMPosnZWT(in_stream, 0, 0, 0);
+  for (int i = 0; i < hdr.nz; ++i) {
+    IMRdSec(in_stream, buffer.data());
+    IMWrSec(out_stream, buffer.data());
+  }
+  IMWrHdr(out_stream, "written by test", 0, hdr.amin, hdr.amax, hdr.amean);
+
+  // header writes on a read-only stream are errors, as section writes are
+  EXPECT_THROW(IMPutHdr(in_stream, &hdr), std::runtime_error);
+  EXPECT_THROW(IMWrHdr(in_stream, "title", 0, 0, 0, 0), std::runtime_error);
+  IW_MRC_HEADER empty = hdr;
+  empty.nx = 0;
+  EXPECT_THROW(DVWriter("empty.dv", empty), std::runtime_error);
+
+  // an extended header set before putHeader survives it when inbsym matches
+  {
+    std::vector<char> records(64);
+    for (size_t i = 0; i < records.size(); ++i) records[i] = static_cast<char>(i + 1);
+    IW_MRC_HEADER small = hdr;
+    small.inbsym = 64;
+    small.nint = small.nreal = 0;
+    std::vector<uint16_t> section(hdr.nx * hdr.ny, 3);
+    {
+      DVWriter early("early.dv");
+      early.setExtendedHeader(records.data(), records.size());
+      small.inbsym = 32;
+      EXPECT_THROW(early.putHeader(small), std::runtime_error);
+      small.inbsym = 64;
+      early.putHeader(small);
+      for (int i = 0; i < small.nz; ++i) early.writeSec(section.data());
+    }
+    EXPECT_EQ(DVFile("early.dv").readExtendedHeader(), records);
+  }
+
+  // the header on disk already reflects the appended timepoints
+  DVFile partial("written.dv");
+  EXPECT_EQ(partial.getHeader().num_times, 2);
+  EXPECT_EQ(partial.getHeader().nz, 18);
+  partial.close();
+  IMClose(out_stream);
+  IMClose(in_stream);
+
+  DVFile original("example.dv");
+  DVFile written("written.dv");
+  IW_MRC_Header whdr = written.getHeader();
+  EXPECT_EQ(whdr.nx, hdr.nx);
+  EXPECT_EQ(whdr.num_waves, hdr.num_waves);
+  EXPECT_EQ(whdr.num_planes(), hdr.num_planes());
+  EXPECT_EQ(whdr.interleaved, hdr.interleaved);
+  EXPECT_EQ(std::string(whdr.label, 15), "written by test");
+
+  std::vector<uint16_t> expected(hdr.nx * hdr.ny, 0);
+  for (int t = 0; t < hdr.num_times; ++t) {
+    for (int w = 0; w < hdr.num_waves; ++w) {
+      for (int z = 0; z < hdr.num_planes(); ++z) {
+        original.readSec(expected.data(), t, w, z);
+        written.readSec(buffer.data(), t, w, z);
+        ASSERT_EQ(buffer, expected) << "t=" << t << " w=" << w << " z=" << z;
+      }
+    }
+  }
+}
+
+TEST(DVFileTest, WriteTimepointsIncrementally) {
+  IW_MRC_Header hdr;
+  std::memset(&hdr, 0, sizeof(hdr));
+  hdr.nx = 8;
+  hdr.ny = 4;
+  hdr.mode = static_cast<int>(PixelType::UINT16);
+  hdr.num_waves = 2;
+  hdr.num_times = 1;
+  hdr.nz = 3 * 2;
+  hdr.interleaved = 2;
+
+  std::vector<uint16_t> timepoint(8 * 4 * 6);
+  {
+    DVWriter writer("stream.dv", hdr);
+    for (int t = 0; t < 5; ++t) {
+      for (size_t i = 0; i < timepoint.size(); ++i) {
+        timepoint[i] = static_cast<uint16_t>(t * 1000 + i);
+      }
+      writer.writeTimepoint(timepoint.data());
+      writer.flush();
+      EXPECT_EQ(writer.getHeader().num_times, t + 1);
+    }
+  }
+
+  DVFile file("stream.dv");
+  EXPECT_EQ(file.getHeader().num_times, 5);
+  EXPECT_EQ(file.getHeader().nz, 30);
+  std::vector<uint16_t> plane(8 * 4);
+  file.readSec(plane.data(), 3, 1, 2);
+  EXPECT_EQ(plane[0], 3000 + (1 * 3 + 2) * 32);
+}
+
+TEST(DVFileTest, BuildPyramidInFile) {
+  copyFile("example.dv", "pyramid.dv");
+  buildPyramid("pyramid.dv", 2);
+
+  DVFile file("pyramid.dv");
+  ASSERT_EQ(file.numResolutions(), 3);
+  IW_MRC_Header l1 = file.levelHeader(1);
+  IW_MRC_Header l2 = file.levelHeader(2);
+  EXPECT_EQ(l1.nx, 16);
+  EXPECT_EQ(l1.ny, 16);
+  EXPECT_EQ(l1.num_planes(), 3);
+  EXPECT_EQ(l2.nx, 8);
+
+  std::vector<uint16_t> full(32 * 32), half(16 * 16), quarter(8 * 8);
+  file.readSecAt(full.data(), 1, 2, 1);
+  file.readSecAt(half.data(), 1, 2, 1, 1);
+  file.readSecAt(quarter.data(), 1, 2, 1, 2);
+  EXPECT_EQ(half[0], blockMean(full, 32, 0, 0));
+  EXPECT_EQ(half[5 * 16 + 7], blockMean(full, 32, 7, 5));
+  EXPECT_EQ(quarter[3 * 8 + 2], blockMean(half, 16, 2, 3));
+
+  // full resolution data are untouched
+  DVFile original("example.dv");
+  std::vector<uint16_t> expected(32 * 32);
+  original.readSecAt(expected.data(), 1, 2, 1);
+  EXPECT_EQ(full, expected);
+}
+
+TEST(DVFileTest, BuildPyramidSidecar) {
+  buildPyramid("example.dv", 1, 3, pyramidSidecarPath("example.dv"));
+
+  DVPyramid pyramid("example.dv");
+  ASSERT_EQ(pyramid.numLevels(), 2);
+  IW_MRC_Header l1 = pyramid.levelHeader(1);
+  EXPECT_EQ(l1.nx, 16);
+  EXPECT_EQ(l1.num_planes(), 1);
+  EXPECT_EQ(pyramid.levelForScale(1.0), 0);
+  EXPECT_EQ(pyramid.levelForScale(0.25), 1);
+
+  std::vector<uint16_t> plane(32 * 32), half(16 * 16);
+  uint32_t sum = 0;
+  for (int z = 0; z < 3; ++z) {
+    pyramid.readSec(plane.data(), 0, 1, z, 0);
+    sum += plane[0] + plane[1] + plane[32] + plane[33];
+  }
+  pyramid.readSec(half.data(), 0, 1, 0, 1);
+  EXPECT_EQ(half[0], (sum + 6) / 12);
+}
+
+TEST(DVFileTest, ReadBinned) {
+  DVFile file("example.dv");
+  IW_MRC_Header bh = file.binnedHeader(4, 3);
+  EXPECT_EQ(bh.nx, 8);
+  EXPECT_EQ(bh.ny, 8);
+  EXPECT_EQ(bh.num_planes(), 1);
+  EXPECT_EQ(bh.num_waves, 3);
+
+  std::vector<uint16_t> full(32 * 32), binned(16 * 16), summed(8 * 8);
+  file.readSecAt(full.data(), 1, 0, 2);
+  file.readSecBinned(binned.data(), 1, 0, 2, 2);
+  EXPECT_EQ(binned[0], blockMean(full, 32, 0, 0));
+  EXPECT_EQ(binned[9 * 16 + 15], blockMean(full, 32, 15, 9));
+
+  // 4x4x3 sums are accumulated wide and saturate at the UINT16 range
+  file.readSecBinned(summed.data(), 0, 2, 0, 4, 3, BinMode::SUM);
+  uint64_t sum = 0;
+  for (int z = 0; z < 3; ++z) {
+    file.readSecAt(full.data(), 0, 2, z);
+    for (int y = 4; y < 8; ++y) {
+      for (int x = 8; x < 12; ++x) sum += full[y * 32 + x];
+    }
+  }
+  EXPECT_EQ(summed[1 * 8 + 2], std::min<uint64_t>(sum, 65535));
+
+  EXPECT_THROW(file.readSecBinned(summed.data(), 0, 0, 1, 4, 3), std::runtime_error);
+}
+
+TEST(DVFileTest, CompressedRoundTrip) {
+  const uint8_t repetitive[] = "abcabcabcabcabcabcabcabcabcabcabcabcabcabcabcabcabc0123456789";
+  std::vector<uint8_t> out(dvlz::compressBound(sizeof(repetitive)));
+  size_t size = dvlz::compress(repetitive, sizeof(repetitive), out.data());
+  EXPECT_LT(size, sizeof(repetitive));
+  uint8_t restored[sizeof(repetitive)];
+  dvlz::decompress(out.data(), size, restored, sizeof(restored));
+  EXPECT_EQ(std::memcmp(restored, repetitive, sizeof(repetitive)), 0);
+  EXPECT_THROW(dvlz::decompress(out.data(), size - 1, restored, sizeof(restored)),
+               std::runtime_error);
+
+  DVFile original("example.dv");
+  IW_MRC_Header hdr = original.getHeader();
+  std::vector<uint16_t> expected(32 * 32), actual(32 * 32);
+  for (int tile : {0, 12}) {
+    compressDVFile("example.dv", "example.dvz", tile, tile);
+    DVCompressedFile packed("example.dvz");
+    EXPECT_GT(packed.compressionRatio(), 1.0);
+    EXPECT_EQ(packed.getHeader().nz, hdr.nz);
+    EXPECT_EQ(packed.extendedHeader(), original.readExtendedHeader());
+    for (int t = 0; t < hdr.num_times; ++t) {
+      for (int w = 0; w < hdr.num_waves; ++w) {
+        for (int z = 0; z < hdr.num_planes(); ++z) {
+          original.readSecAt(expected.data(), t, w, z);
+          packed.readSec(actual.data(), t, w, z);
+          ASSERT_EQ(actual, expected) << "tile=" << tile << " t=" << t << " w=" << w << " z=" << z;
+        }
+      }
+    }
+  }
+
+  // a zero or oversized chunk shape on disk is rejected at open
+  for (uint32_t tile_x : {0u, 33u}) {
+    std::fstream patch("example.dvz", std::ios::binary | std::ios::in | std::ios::out);
+    DVZHeader zh;
+    patch.read(reinterpret_cast<char*>(&zh), sizeof(zh));
+    zh.tile_x = tile_x;
+    patch.seekp(0);
+    patch.write(reinterpret_cast<const char*>(&zh), sizeof(zh));
+    patch.close();
+    EXPECT_THROW(DVCompressedFile("example.dvz"), std::runtime_error);
+  }
+
+  // so is a chunk index pointing outside the file, backwards, or at oversized chunks
+  const uint64_t index_at = sizeof(DVZHeader) + sizeof(IW_MRC_Header) + hdr.inbsym;
+  auto corrupt = [&](size_t entry, auto edit) {
+    compressDVFile("example.dv", "example.dvz", 12, 12);
+    std::fstream patch("example.dvz", std::ios::binary | std::ios::in | std::ios::out);
+    DVZChunk chunk;
+    patch.seekg(index_at + entry * sizeof(chunk));
+    patch.read(reinterpret_cast<char*>(&chunk), sizeof(chunk));
+    edit(chunk);
+    patch.seekp(index_at + entry * sizeof(chunk));
+    patch.write(reinterpret_cast<const char*>(&chunk), sizeof(chunk));
+    patch.close();
+    EXPECT_THROW(DVCompressedFile("example.dvz"), std::runtime_error);
+  };
+  corrupt(5, [](DVZChunk& c) { c.offset = UINT64_MAX - 4; });
+  corrupt(5, [](DVZChunk& c) { c.offset -= 8; });
+  corrupt(0, [](DVZChunk& c) { c.offset = 0; });
+  corrupt(3, [](DVZChunk& c) { c.compressed_size = c.raw_size * 2; });
+}
+
+TEST(DVFileTest, ConvertToZarr) {
+  ZarrOptions options;
+  options.chunk_z = 2;
+  options.chunk_y = 20;
+  options.chunk_x = 20;
+  options.threads = 2;
+  std::filesystem::remove_all("example.zarr");
+  convertToZarr("example.dv", "example.zarr", options);
+
+  std::ifstream zarray("example.zarr/0/.zarray");
+  std::string meta((std::istreambuf_iterator<char>(zarray)), std::istreambuf_iterator<char>());
+  EXPECT_NE(meta.find("\"shape\": [2, 3, 3, 32, 32]"), std::string::npos);
+  EXPECT_NE(meta.find("\"chunks\": [1, 1, 2, 20, 20]"), std::string::npos);
+  EXPECT_TRUE(std::filesystem::exists("example.zarr/.zattrs"));
+
+  // last chunk along every axis: z = 2 only, rows and columns 20..31, padded with zeros
+  std::ifstream in("example.zarr/0/1/2/1/1/1", std::ios::binary);
+  std::vector<uint16_t> chunk(2 * 20 * 20);
+  in.read(reinterpret_cast<char*>(chunk.data()), chunk.size() * sizeof(uint16_t));
+  ASSERT_TRUE(in.good());
+
+  DVFile file("example.dv");
+  std::vector<uint16_t> plane(32 * 32);
+  file.readSecAt(plane.data(), 1, 2, 2);
+  EXPECT_EQ(chunk[0], plane[20 * 32 + 20]);
+  EXPECT_EQ(chunk[11 * 20 + 11], plane[31 * 32 + 31]);
+  EXPECT_EQ(chunk[11 * 20 + 12], 0);
+  EXPECT_EQ(chunk[20 * 20], 0);
+
+  // the source name is escaped in .zattrs; a tiny budget still converts
+  EXPECT_EQ(jsonEscape("a\"b\\c\n"), "a\\\"b\\\\c\\n");
+  copyFile("example.dv", "odd\"name\\.dv");
+  options.max_inflight_bytes = 1;
+  std::filesystem::remove_all("odd.zarr");
+  convertToZarr("odd\"name\\.dv", "odd.zarr", options);
+  std::ifstream zattrs("odd.zarr/.zattrs");
+  std::string attrs((std::istreambuf_iterator<char>(zattrs)), std::istreambuf_iterator<char>());
+  EXPECT_NE(attrs.find("\"name\": \"odd\\\"name\\\\.dv\""), std::string::npos);
+  EXPECT_TRUE(std::filesystem::exists("odd.zarr/0/1/2/1/1/1"));
+}
+
+TEST(DVFileTest, ExportBigTiff) {
+  DVFile file("example.dv");
+  std::vector<uint16_t> plane(32 * 32);
+  file.readSecAt(plane.data(), 1, 2, 1);
+
+  for (bool packbits : {false, true}) {
+    TiffOptions options;
+    options.tile_size = 16;
+    options.packbits = packbits;
+    exportBigTiff("example.dv", "example.ome.tif", options);
+
+    std::ifstream in("example.ome.tif", std::ios::binary);
+    std::vector<uint8_t> tif((std::istreambuf_iterator<char>(in)),
+                             std::istreambuf_iterator<char>());
+    auto u16 = [&](uint64_t at) { return static_cast<uint16_t>(tif[at] | (tif[at + 1] << 8)); };
+    auto u64 = [&](uint64_t at) {
+      uint64_t v;
+      std::memcpy(&v, &tif[at], 8);
+      return v;
+    };
+    ASSERT_EQ(u16(2), 43);  // BigTIFF
+
+    // OME plane index of (t=1, c=2, z=1) in XYZCT order
+    uint64_t ifd = u64(8);
+    for (int i = 0; i < 1 + 3 * (2 + 3 * 1); ++i) ifd = u64(ifd + 8 + u64(ifd) * 20);
+    uint64_t offsets = 0, counts = 0;
+    for (uint64_t e = 0; e < u64(ifd); ++e) {
+      uint64_t at = ifd + 8 + e * 20;
+      if (u16(at) == 259) {
+        EXPECT_EQ(u16(at + 12), packbits ? 32773 : 1);
+      }
+      if (u16(at) == 324) offsets = u64(at + 12);
+      if (u16(at) == 325) counts = u64(at + 12);
+    }
+    // tile (x=1, y=1) of a 2x2 grid
+    std::vector<uint16_t> tile(16 * 16);
+    uint64_t data = u64(offsets + 3 * 8), size = u64(counts + 3 * 8);
+    if (packbits) {
+      packBitsDecode(&tif[data], size, reinterpret_cast<uint8_t*>(tile.data()), 16 * 16 * 2);
+    } else {
+      ASSERT_EQ(size, 16u * 16 * 2);
+      std::memcpy(tile.data(), &tif[data], size);
+    }
+    EXPECT_EQ(tile[0], plane[16 * 32 + 16]);
+    EXPECT_EQ(tile[15 * 16 + 15], plane[31 * 32 + 31]);
+  }
+}
+
+TEST(DVFileTest, CInterfaceViews) {
+  dv_file* handle = nullptr;
+  EXPECT_EQ(dv_open("missing.dv", &handle), -1);
+  EXPECT_STRNE(dv_last_error(), "");
+  ASSERT_EQ(dv_open("example.dv", &handle), 0);
+
+  dv_info info;
+  ASSERT_EQ(dv_get_info(handle, &info), 0);
+  EXPECT_EQ(info.nx, 32);
+  EXPECT_EQ(info.num_planes, 3);
+  EXPECT_EQ(info.itemsize, 2u);
+  EXPECT_EQ(info.byteorder, '<');
+
+  dv_view view = {};
+  ASSERT_EQ(dv_view_section(handle, 1, 2, 1, &view), 0);
+  EXPECT_EQ(dv_view_section(handle, 2, 0, 0, &view), -1);
+  EXPECT_EQ(view.shape[0], 32);
+  EXPECT_EQ(view.strides[0], 64);
+
+  // the view stays valid after the handle is closed
+  dv_close(handle);
+  DVFile file("example.dv");
+  std::vector<uint16_t> expected(32 * 32);
+  file.readSecAt(expected.data(), 1, 2, 1);
+  EXPECT_EQ(std::memcmp(view.data, expected.data(), expected.size() * 2), 0);
+  dv_release(&view);
+  EXPECT_EQ(view.data, nullptr);
+
+  // zero wavelength and time counts mean one of each
+  IW_MRC_Header hdr;
+  std::memset(&hdr, 0, sizeof(hdr));
+  hdr.nx = 4;
+  hdr.ny = 2;
+  hdr.nz = 2;
+  hdr.mode = static_cast<int>(PixelType::UINT16);
+  std::vector<uint16_t> plane(8, 7);
+  {
+    DVWriter writer("counts.dv", hdr);
+    writer.writeSec(plane.data());
+    writer.writeSec(plane.data());
+  }
+  {
+    // the writer stores counts of 1, so zero them in place
+    std::fstream patch("counts.dv", std::ios::binary | std::ios::in | std::ios::out);
+    char raw[1024];
+    patch.read(raw, sizeof(raw));
+    hdr = decodeHeader(raw, false);
+    hdr.num_waves = 0;
+    hdr.num_times = 0;
+    encodeHeader(hdr, hostIsBigEndian(), raw);
+    patch.seekp(0);
+    patch.write(raw, sizeof(raw));
+  }
+  ASSERT_EQ(dv_open("counts.dv", &handle), 0);
+  ASSERT_EQ(dv_get_info(handle, &info), 0);
+  EXPECT_EQ(info.num_waves, 1);
+  EXPECT_EQ(info.num_times, 1);
+  ASSERT_EQ(dv_view_section(handle, 0, 0, 1, &view), 0);
+  EXPECT_EQ(static_cast<const uint16_t*>(view.data)[3], 7);
+  dv_release(&view);
+  dv_close(handle);
+
+  // compressed copies read the same counts the same way
+  compressDVFile("counts.dv", "counts.dvz");
+  std::fill(plane.begin(), plane.end(), 0);
+  DVCompressedFile("counts.dvz").readSecAt(plane.data(), 0, 0, 1);
+  EXPECT_EQ(plane[3], 7);
+}
+
+TEST(DVFileTest, SectionBufferPool) {
+  DVFile file("example.dv");
+  BufferPoolOptions options;
+  options.alignment = 4096;
+  SectionBufferPool pool(file, options);
+  EXPECT_EQ(pool.bufferSize(), 32u * 32 * 2);
+
+  for (int i = 0; i < 10; ++i) {
+    SectionBuffer buffer = pool.acquire();
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(buffer.data()) % 4096, 0u);
+    file.readSecAt(buffer.data(), 0, 0, 0);
+    EXPECT_EQ(buffer.as<uint16_t>()[0], 326);
+  }
+  EXPECT_EQ(pool.allocated(), 1u);  // the same buffer is recycled
+
+  // steady state across threads: at most two buffers per thread ever get allocated
+  std::vector<std::thread> threads;
+  for (int th = 0; th < 4; ++th) {
+    threads.emplace_back([&, th] {
+      for (int i = 0; i < 500; ++i) {
+        SectionBuffer a = pool.acquire();
+        SectionBuffer b = pool.acquire();
+        file.readSecAt(a.data(), th % 2, 1, 2);
+        b = std::move(a);
+        EXPECT_FALSE(a);
+      }
+    });
+  }
+  for (auto& th : threads) th.join();
+  EXPECT_LE(pool.allocated(), 8u);
+
+  SectionBufferPool huge(file.frameSize(), BufferPoolOptions{64, true, 4});
+  SectionBuffer h = huge.acquire();
+  file.readSecAt(h.data(), 0, 0, 0);
+  EXPECT_EQ(h.as<uint16_t>()[0], 326);
+
+  // failed allocations give their slot back instead of shrinking the pool
+  BufferPoolOptions tiny;
+  tiny.max_buffers = 2;
+  SectionBufferPool impossible(size_t(1) << 60, tiny);
+  for (int i = 0; i < 5; ++i) EXPECT_THROW(impossible.acquire(), std::bad_alloc);
+  EXPECT_EQ(impossible.allocated(), 0u);
+}
+
+TEST(DVFileTest, ParallelSections) {
+  // every index is visited exactly once, even with very uneven costs
+  std::vector<std::atomic<int>> visits(1000);
+  parallelForStealing(
+      visits.size(),
+      [&](size_t i, unsigned) {
+        if (i < 10) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        visits[i]++;
+      },
+      4);
+  for (auto& v : visits) ASSERT_EQ(v.load(), 1);
+
+  DVFile file("example.dv");
+  IW_MRC_Header hdr = file.getHeader();
+  auto planeSum = [](const SectionRef& s) {
+    uint64_t sum = 0;
+    for (int i = 0; i < s.nx * s.ny; ++i) sum += s.as<uint16_t>()[i];
+    return sum;
+  };
+  std::vector<uint64_t> sums = transformSections<uint64_t>(file, planeSum, 4);
+  ASSERT_EQ(sums.size(), 18u);
+
+  std::vector<uint16_t> plane(32 * 32);
+  for (int t = 0; t < hdr.num_times; ++t) {
+    for (int w = 0; w < hdr.num_waves; ++w) {
+      for (int z = 0; z < hdr.num_planes(); ++z) {
+        file.readSecAt(plane.data(), t, w, z);
+        uint64_t expected = 0;
+        for (uint16_t v : plane) expected += v;
+        EXPECT_EQ(sums[(t * hdr.num_waves + w) * hdr.num_planes() + z], expected);
+      }
+    }
+  }
+
+  // works on any section source
+  compressDVFile("example.dv", "sections.dvz");
+  DVCompressedFile packed("sections.dvz");
+  EXPECT_EQ(transformSections<uint64_t>(packed, planeSum, 3), sums);
+}
+
+TEST(DVFileTest, ForeignByteOrder) {
+  static_assert(findHeaderField("interleaved")->offset == 182, "layout table out of step");
+
+  // rewrite example.dv in the other byte order
+  std::ifstream in("example.dv", std::ios::binary);
+  std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  DVFile file("example.dv");
+  swapHeaderBytes(bytes.data());
+  swapBytes(bytes.data() + file.dataOffset(), bytes.size() - file.dataOffset(), 2);
+  std::ofstream("swapped.dv", std::ios::binary).write(bytes.data(), bytes.size());
+
+  DVFile swapped("swapped.dv");
+  EXPECT_NE(swapped.isBigEndian(), file.isBigEndian());
+  EXPECT_EQ(std::memcmp(&swapped.header(), &file.header(), sizeof(IW_MRC_Header)), 0);
+
+  std::vector<uint16_t> expected(32 * 32), actual(32 * 32);
+  for (int i = 0; i < 18; ++i) {
+    file.readSecIndexAt(expected.data(), i);
+    swapped.readSecIndexAt(actual.data(), i);
+    ASSERT_EQ(actual, expected);
+  }
+  file.readSec(expected.data(), 1, 2, 0);
+  swapped.readSec(actual.data(), 1, 2, 0);
+  EXPECT_EQ(actual, expected);
+
+  HeaderView view = swapped.headerView();
+  EXPECT_EQ(&*view, &swapped.header());
+  EXPECT_EQ(view.value("nx"), 32);
+  EXPECT_EQ(view.value("num_waves"), 3);
+  EXPECT_FLOAT_EQ(static_cast<float>(view.value("amax")), 1743);
+  EXPECT_EQ(view->num_times, 2);
+  EXPECT_THROW(view.value("no_such_field"), std::runtime_error);
+}
+
+TEST(DVFileTest, FlatFieldCorrection) {
+  IW_MRC_Header hdr;
+  std::memset(&hdr, 0, sizeof(hdr));
+  hdr.nx = 32;
+  hdr.ny = 32;
+  hdr.mode = static_cast<int>(PixelType::UINT16);
+  hdr.num_waves = 1;
+  hdr.num_times = 1;
+  hdr.nz = 2;
+  hdr.interleaved = 2;
+  std::vector<uint16_t> plane(32 * 32);
+  {
+    // dark of 200, averaged from two planes
+    DVWriter dark("dark.dv", hdr);
+    std::fill(plane.begin(), plane.end(), 190);
+    dark.writeSec(plane.data());
+    std::fill(plane.begin(), plane.end(), 210);
+    dark.writeSec(plane.data());
+  }
+  {
+    // flat twice as bright on the left half
+    DVWriter flat("flat.dv", hdr);
+    for (size_t i = 0; i < plane.size(); ++i) plane[i] = i % 32 < 16 ? 1400 : 800;
+    flat.writeSec(plane.data());
+    flat.writeSec(plane.data());
+  }
+
+  DVFile file("example.dv");
+  EXPECT_THROW(file.readSecCorrected(plane.data(), 0, 0, 0), std::runtime_error);
+  file.setFlatField(std::make_shared<FlatField>(loadFlatField("dark.dv", "flat.dv")));
+  ASSERT_NE(file.flatField(), nullptr);
+  EXPECT_FLOAT_EQ(file.flatField()->darkFor(2)[5], 200);
+  EXPECT_FLOAT_EQ(file.flatField()->invFlatFor(1)[0], 0.75f);
+  EXPECT_FLOAT_EQ(file.flatField()->invFlatFor(1)[31], 1.5f);
+
+  std::vector<uint16_t> raw(32 * 32), corrected(32 * 32);
+  std::vector<float> as_float(32 * 32);
+  file.readSecAt(raw.data(), 1, 2, 1);
+  file.readSecCorrected(as_float.data(), 1, 2, 1);
+  file.readSecCorrected(static_cast<void*>(corrected.data()), 1, 2, 1);
+  for (size_t i = 0; i < raw.size(); ++i) {
+    float expected = (raw[i] - 200.0f) * (i % 32 < 16 ? 0.75f : 1.5f);
+    ASSERT_FLOAT_EQ(as_float[i], expected);
+    ASSERT_EQ(corrected[i], expected < 0 ? 0 : static_cast<uint16_t>(expected + 0.5f));
+  }
+
+  file.setFlatField(nullptr);
+  EXPECT_EQ(file.flatField(), nullptr);
+
+  // 32-bit limits and NaN (a zero flat) saturate or become 0 rather than overflow the cast
+  const int32_t big[4] = {2147483000, -2147483000, 5, 7};
+  const float dark[4] = {0, 0, 0, 0};
+  const float gain[4] = {2, 2, std::numeric_limits<float>::quiet_NaN(), 1};
+  int32_t out[4];
+  correctFlatDark(big, dark, gain, 4, out);
+  EXPECT_EQ(out[0], std::numeric_limits<int32_t>::max());
+  EXPECT_EQ(out[1], std::numeric_limits<int32_t>::lowest());
+  EXPECT_EQ(out[2], 0);
+  EXPECT_EQ(out[3], 7);
+  EXPECT_EQ(saturateCast<int32_t>(2147483647.0f), std::numeric_limits<int32_t>::max());
+  EXPECT_EQ(saturateCast<int16_t>(std::numeric_limits<double>::quiet_NaN()), 0);
+}
+
+TEST(DVFileTest, SectionChecksums) {
+  EXPECT_EQ(crc32c("123456789", 9), 0xE3069283u);
+  EXPECT_EQ(crc32c("56789", 5, crc32c("1234", 4)), 0xE3069283u);
+  // whichever path the CPU picked agrees with the table
+  std::vector<uint8_t> noise(1021);
+  for (size_t i = 0; i < noise.size(); ++i) noise[i] = static_cast<uint8_t>(i * 131 + 7);
+  EXPECT_EQ(crc32c(noise.data(), noise.size()),
+            ~crc32c_detail::table(noise.data(), noise.size(), ~0u));
+
+  copyFile("example.dv", "checked.dv");
+  writeChecksums("checked.dv");
+  bool header_ok = false;
+  EXPECT_TRUE(verifyChecksums("checked.dv", "", 4, &header_ok).empty());
+  EXPECT_TRUE(header_ok);
+
+  // flip one byte inside section 7 and drop the last section entirely
+  DVFile file("checked.dv");
+  const uint64_t offset = file.dataOffset() + 7 * file.frameSize() + 100;
+  const uint64_t size = file.dataOffset() + 17 * file.frameSize();
+  file.close();
+  {
+    std::fstream f("checked.dv", std::ios::binary | std::ios::in | std::ios::out);
+    f.seekp(offset);
+    f.put('\x5a');
+  }
+  std::filesystem::resize_file("checked.dv", size);
+
+  std::vector<DamagedSection> damaged = verifyChecksums("checked.dv", "", 4, &header_ok);
+  EXPECT_TRUE(header_ok);
+  ASSERT_EQ(damaged.size(), 2u);
+  int t, w, z;
+  IW_MRC_Header hdr = DVFile("example.dv").getHeader();
+  hdr.section_zwt(7, t, w, z);
+  EXPECT_EQ(damaged[0].t, t);
+  EXPECT_EQ(damaged[0].w, w);
+  EXPECT_EQ(damaged[0].z, z);
+  EXPECT_TRUE(damaged[0].readable);
+  EXPECT_NE(damaged[0].actual, damaged[0].expected);
+  EXPECT_FALSE(damaged[1].readable);
+  EXPECT_EQ(damaged[1].t, 1);
+}
+
+TEST(DVFileTest, CompareFiles) {
+  copyFile("example.dv", "compared.dv");
+  EXPECT_TRUE(compareDVFiles("example.dv", "compared.dv").identical);
+
+  // raise one pixel of section (1, 2, 0) by 40 and another by 30
+  DVFile original("example.dv");
+  const uint64_t offset = original.sectionOffset(1, 2, 0);
+  std::vector<uint16_t> plane(32 * 32);
+  original.readSecAt(plane.data(), 1, 2, 0);
+  plane[5] += 40;
+  plane[600] += 30;
+  {
+    std::fstream f("compared.dv", std::ios::binary | std::ios::in | std::ios::out);
+    f.seekp(offset);
+    f.write(reinterpret_cast<const char*>(plane.data()), plane.size() * 2);
+  }
+
+  CompareResult result = compareDVFiles("example.dv", "compared.dv");
+  EXPECT_TRUE(result.same_shape);
+  EXPECT_FALSE(result.identical);
+  ASSERT_EQ(result.planes.size(), 18u);
+  const PlaneDiff& d = result.planes[(1 * 3 + 2) * 3 + 0];
+  EXPECT_EQ(d.t, 1);
+  EXPECT_EQ(d.w, 2);
+  EXPECT_EQ(d.z, 0);
+  EXPECT_FALSE(d.equal);
+  EXPECT_DOUBLE_EQ(d.max_abs_diff, 40);
+  EXPECT_DOUBLE_EQ(d.rmse, std::sqrt((40.0 * 40 + 30 * 30) / 1024));
+  EXPECT_NEAR(d.psnr, 20 * std::log10(65535.0) - 10 * std::log10(2500.0 / 1024), 1e-9);
+  EXPECT_DOUBLE_EQ(result.max_abs_diff, 40);
+  EXPECT_DOUBLE_EQ(result.rmse, std::sqrt(2500.0 / 1024 / 18));
+  int differing = 0;
+  for (const PlaneDiff& p : result.planes) differing += !p.equal;
+  EXPECT_EQ(differing, 1);
+
+  CompareOptions exact;
+  exact.exact = true;
+  result = compareDVFiles("example.dv", "compared.dv", exact);
+  EXPECT_FALSE(result.identical);
+  ASSERT_EQ(result.planes.size(), 1u);
+  EXPECT_EQ(result.planes[0].w, 2);
+
+  IW_MRC_Header small = original.getHeader();
+  small.nx = 16;
+  DVWriter("small.dv", small).close();
+  EXPECT_FALSE(compareDVFiles("example.dv", "small.dv").same_shape);
+}
+
+TEST(DVFileTest, Histograms) {
+  DVFile file("example.dv");
+  HistogramOptions options;
+  options.threads = 4;
+  std::vector<Histogram> hists = computeHistograms(file, options);
+  ASSERT_EQ(hists.size(), 3u);
+
+  std::vector<uint16_t> plane(32 * 32);
+  for (int w = 0; w < 3; ++w) {
+    std::vector<uint16_t> values;
+    for (int t = 0; t < 2; ++t) {
+      for (int z = 0; z < 3; ++z) {
+        file.readSecAt(plane.data(), t, w, z);
+        values.insert(values.end(), plane.begin(), plane.end());
+      }
+    }
+    std::sort(values.begin(), values.end());
+    const Histogram& h = hists[w];
+    EXPECT_TRUE(h.exact);
+    EXPECT_EQ(h.counts.size(), 65536u);
+    EXPECT_EQ(h.total, values.size());
+    EXPECT_EQ(h.counts[values[100]],
+              static_cast<uint64_t>(std::count(values.begin(), values.end(), values[100])));
+    EXPECT_EQ(h.percentile(0), values.front());
+    EXPECT_EQ(h.percentile(100), values.back());
+    EXPECT_EQ(h.percentile(50), values[values.size() / 2 - 1]);
+  }
+
+  // every other (t, z) section
+  options.stride = 2;
+  std::vector<Histogram> sampled = computeHistograms(file, options);
+  EXPECT_EQ(sampled[0].total, 3u * 32 * 32);
+
+  // floats get bins over the data range
+  IW_MRC_Header hdr;
+  std::memset(&hdr, 0, sizeof(hdr));
+  hdr.nx = 100;
+  hdr.ny = 10;
+  hdr.mode = static_cast<int>(PixelType::FLOAT32);
+  hdr.num_waves = 1;
+  hdr.num_times = 1;
+  hdr.nz = 1;
+  std::vector<float> ramp(1000);
+  for (size_t i = 0; i < ramp.size(); ++i) ramp[i] = static_cast<float>(i) / 10;
+  DVWriter("ramp.dv", hdr).writeSec(ramp.data());
+  options.stride = 1;
+  options.bins = 1000;
+  Histogram h = computeHistograms(DVFile("ramp.dv"), options)[0];
+  EXPECT_FALSE(h.exact);
+  EXPECT_EQ(h.total, 1000u);
+  EXPECT_DOUBLE_EQ(h.lo, 0);
+  EXPECT_NEAR(h.bin_width, 99.9 / 1000, 1e-6);
+  EXPECT_NEAR(h.percentile(50), 50, 0.2);
+  EXPECT_NEAR(h.limits().second, 99.9, 0.2);
+
+  // infinities land in the end bins without widening the range
+  ramp[10] = std::numeric_limits<float>::infinity();
+  ramp[20] = -std::numeric_limits<float>::infinity();
+  ramp[30] = std::numeric_limits<float>::quiet_NaN();
+  DVWriter("ramp.dv", hdr).writeSec(ramp.data());
+  h = computeHistograms(DVFile("ramp.dv"), options)[0];
+  EXPECT_EQ(h.total, 999u);
+  EXPECT_DOUBLE_EQ(h.lo, 0);
+  EXPECT_NEAR(h.bin_width, 99.9 / 1000, 1e-6);
+  EXPECT_EQ(h.counts.front(), 2u);
+  EXPECT_EQ(h.counts.back(), 2u);
+
+  // nothing finite but infinities: a zero-width range
+  std::fill(ramp.begin(), ramp.end(), std::numeric_limits<float>::infinity());
+  ramp[0] = -ramp[0];
+  DVWriter("ramp.dv", hdr).writeSec(ramp.data());
+  h = computeHistograms(DVFile("ramp.dv"), options)[0];
+  EXPECT_EQ(h.total, 1000u);
+  EXPECT_EQ(h.counts.front(), 1u);
+  EXPECT_EQ(h.counts.back(), 999u);
+}
+
+TEST(DVFileTest, ComplexKernels) {
+  IW_MRC_Header hdr;
+  std::memset(&hdr, 0, sizeof(hdr));
+  hdr.nx = 8;
+  hdr.ny = 4;
+  hdr.mode = static_cast<int>(PixelType::COMPLEX64);
+  hdr.num_waves = 1;
+  hdr.num_times = 1;
+  hdr.nz = 1;
+  hdr.file_type = 8000;
+  std::vector<float> pupil(2 * 8 * 4);
+  for (int i = 0; i < 32; ++i) {
+    pupil[2 * i] = static_cast<float>(i % 5) - 2;
+    pupil[2 * i + 1] = static_cast<float>(i % 3) - 1;
+  }
+  DVWriter("pupil.dv", hdr).writeSec(pupil.data());
+
+  DVFile file("pupil.dv");
+  std::vector<float> out(32), real(32), imag(32);
+  file.readSecComplex(out.data(), 0, 0, 0, ComplexPart::MAGNITUDE);
+  for (int i = 0; i < 32; ++i) {
+    EXPECT_FLOAT_EQ(out[i], std::hypot(pupil[2 * i], pupil[2 * i + 1]));
+  }
+  file.readSecComplex(out.data(), 0, 0, 0, ComplexPart::PHASE);
+  for (int i = 0; i < 32; ++i) {
+    EXPECT_FLOAT_EQ(out[i], std::atan2(pupil[2 * i + 1], pupil[2 * i]));
+  }
+  file.readSecComplex(out.data(), 0, 0, 0, ComplexPart::POWER);
+  EXPECT_FLOAT_EQ(out[4], 2 * 2 + 0 * 0);
+  file.readSecSplit(real.data(), imag.data(), 0, 0, 0);
+  for (int i = 0; i < 32; ++i) {
+    EXPECT_EQ(real[i], pupil[2 * i]);
+    EXPECT_EQ(imag[i], pupil[2 * i + 1]);
+  }
+
+  hdr.mode = static_cast<int>(PixelType::COMPLEX_INT16);
+  std::vector<int16_t> otf(2 * 32);
+  for (int i = 0; i < 64; ++i) otf[i] = static_cast<int16_t>(i * (i % 2 ? -3 : 1));
+  DVWriter("otf.dv", hdr).writeSec(otf.data());
+  DVFile packed("otf.dv");
+  packed.readSecComplex(out.data(), 0, 0, 0, ComplexPart::IMAG);
+  EXPECT_FLOAT_EQ(out[3], -21);
+  std::vector<int16_t> re(32), im(32);
+  packed.readSecSplit(re.data(), im.data(), 0, 0, 0);
+  EXPECT_EQ(re[3], 6);
+  EXPECT_EQ(im[3], -21);
+
+  EXPECT_THROW(DVFile("example.dv").readSecComplex(out.data(), 0, 0, 0, ComplexPart::REAL),
+               std::runtime_error);
+}
+
+TEST(DVFileTest, OrthoSlices) {
+  DVFile file("example.dv");
+  std::vector<uint16_t> plane(32 * 32);
+  std::vector<uint16_t> xz(3 * 32), yz(3 * 32);
+  EXPECT_EQ(file.orthoSliceWidth(OrthoAxis::YZ), 32);
+  file.readOrthoSlice(1, 2, OrthoAxis::XZ, 7, xz.data(), 2);
+  file.readOrthoSlice(1, 2, OrthoAxis::YZ, 11, yz.data(), 2);
+  for (int z = 0; z < 3; ++z) {
+    file.readSecAt(plane.data(), 1, 2, z);
+    for (int i = 0; i < 32; ++i) {
+      ASSERT_EQ(xz[z * 32 + i], plane[7 * 32 + i]);
+      ASSERT_EQ(yz[z * 32 + i], plane[i * 32 + 11]);
+    }
+  }
+  EXPECT_THROW(file.readOrthoSlice(0, 0, OrthoAxis::XZ, 32, xz.data()), std::runtime_error);
+}
+
+TEST(DVFileTest, TileCache) {
+  DVFile file("example.dv");
+  std::vector<uint16_t> plane(32 * 32);
+  file.readSecAt(plane.data(), 1, 0, 2);
+
+  std::vector<uint16_t> region(5 * 7);
+  file.readRegion(region.data(), 1, 0, 2, 3, 4, 5, 7);
+  EXPECT_EQ(region[2 * 5 + 1], plane[6 * 32 + 4]);
+
+  TileCacheOptions options;
+  options.tile_size = 10;
+  options.max_bytes = 6 * 10 * 10 * 2;
+  TileCache cache(file, options);
+
+  // spans six tiles, including the short ones at the right and bottom edges
+  std::vector<uint16_t> view(14 * 9);
+  cache.readViewport(view.data(), 1, 0, 2, 17, 23, 14, 9);
+  for (int r = 0; r < 9; ++r) {
+    for (int c = 0; c < 14; ++c) ASSERT_EQ(view[r * 14 + c], plane[(23 + r) * 32 + 17 + c]);
+  }
+  EXPECT_EQ(cache.misses(), 6u);
+  EXPECT_EQ(cache.cachedTiles(), 6u);
+
+  // panning within the same tiles hits the cache
+  cache.readViewport(view.data(), 1, 0, 2, 12, 20, 14, 9);
+  EXPECT_EQ(cache.misses(), 6u);
+  EXPECT_EQ(cache.hits(), 2u);
+  EXPECT_EQ(view[0], plane[20 * 32 + 12]);
+
+  // the whole plane needs 16 tiles, which do not all fit
+  cache.readViewport(plane.data(), 1, 0, 2, 0, 0, 32, 32);
+  EXPECT_LE(cache.cachedBytes(), options.max_bytes);
+  EXPECT_LT(cache.cachedTiles(), 16u);
+  std::vector<uint16_t> expected(32 * 32);
+  file.readSecAt(expected.data(), 1, 0, 2);
+  EXPECT_EQ(plane, expected);
+
+  // (t = 0, z = 3) would share its key with the cached (t = 1, z = 0) in this WZT file
+  cache.readViewport(plane.data(), 1, 0, 0, 0, 0, 8, 8);
+  EXPECT_THROW(cache.readViewport(plane.data(), 0, 0, 3, 0, 0, 8, 8), std::runtime_error);
+  EXPECT_THROW(cache.readViewport(plane.data(), 0, -1, 0, 0, 0, 8, 8), std::runtime_error);
+}
+
+TEST(DVFileTest, TemporalDeltaScan) {
+  IW_MRC_Header hdr;
+  std::memset(&hdr, 0, sizeof(hdr));
+  hdr.nx = 16;
+  hdr.ny = 8;
+  hdr.mode = static_cast<int>(PixelType::UINT16);
+  hdr.num_waves = 2;
+  hdr.num_times = 1;
+  hdr.nz = 2 * 2;
+  hdr.interleaved = 2;
+
+  // a ramp that holds still, then shifts by one pixel and brightens at t = 3
+  std::vector<uint16_t> timepoint(16 * 8 * 4);
+  {
+    DVWriter writer("drift.dv", hdr);
+    for (int t = 0; t < 4; ++t) {
+      for (size_t i = 0; i < timepoint.size(); ++i) {
+        size_t x = i % 16;
+        timepoint[i] = static_cast<uint16_t>(100 + 10 * (t < 3 ? x : (x + 1) % 16) +
+                                             (t == 3 ? 5 : 0));
+      }
+      writer.writeTimepoint(timepoint.data());
+    }
+  }
+
+  std::vector<TemporalDelta> deltas = temporalDeltaScan(DVFile("drift.dv"), 3);
+  ASSERT_EQ(deltas.size(), 3u * 2 * 2);
+  for (const TemporalDelta& d : deltas) {
+    if (d.t < 3) {
+      EXPECT_EQ(d.mean_abs_diff, 0);
+      EXPECT_DOUBLE_EQ(d.correlation, 1);
+    } else {
+      // 15 of 16 columns rise by 15, the wrapped one drops by 145
+      EXPECT_DOUBLE_EQ(d.mean_abs_diff, (15.0 * 15 + 145) / 16);
+      EXPECT_LT(d.correlation, 0.9);
+    }
+  }
+  EXPECT_EQ(deltas.back().t, 3);
+  EXPECT_EQ(deltas.back().w, 1);
+  EXPECT_EQ(deltas.back().z, 1);
+
+  // example.dv has two timepoints
+  EXPECT_EQ(temporalDeltaScan(DVFile("example.dv")).size(), 3u * 3);
+}
+
+TEST(DVFileTest, MultiPositionSplit) {
+  // two positions of two planes each, two wavelengths and two timepoints, in ZWT order
+  IW_MRC_Header hdr;
+  std::memset(&hdr, 0, sizeof(hdr));
+  hdr.nx = 8;
+  hdr.ny = 4;
+  hdr.mode = static_cast<int>(PixelType::UINT16);
+  hdr.num_waves = 2;
+  hdr.num_times = 1;
+  hdr.nz = 4 * 2;
+  hdr.interleaved = 2;
+  hdr.file_type = 20;
+  hdr.nint = 2;
+  hdr.nreal = 6;
+  const int sections = 4 * 2 * 2;
+  std::vector<int32_t> ext(sections * 8, 0);
+  IW_MRC_Header full = hdr;
+  full.num_times = 2;
+  full.nz = sections;
+  for (int i = 0; i < sections; ++i) {
+    int t, w, z;
+    full.section_zwt(i, t, w, z);
+    float stage[3] = {z < 2 ? 100.0f : 2500.0f, z < 2 ? -40.0f : 60.0f, z * 0.5f};
+    ext[i * 8] = i;
+    std::memcpy(&ext[i * 8 + 2 + kStageXFloat], stage, sizeof(stage));
+  }
+  std::vector<uint16_t> plane(8 * 4);
+  {
+    DVWriter writer("positions.dv", hdr);
+    writer.setExtendedHeader(ext.data(), ext.size() * 4);
+    for (int i = 0; i < sections; ++i) {
+      std::fill(plane.begin(), plane.end(), static_cast<uint16_t>(i));
+      writer.writeSec(plane.data());
+    }
+  }
+
+  // the IVE call returns the same records
+  int ival[2];
+  float rval[6];
+  ASSERT_EQ(IMOpen(3, "positions.dv", "ro"), 0);
+  IMRtExHdrZWT(3, 3, 1, 1, ival, rval);
+  IMClose(3);
+  EXPECT_EQ(ival[0], full.section_index(1, 1, 3));
+  EXPECT_FLOAT_EQ(rval[kStageXFloat], 2500);
+  EXPECT_FLOAT_EQ(rval[kStageXFloat + 2], 1.5f);
+
+  MultiPositionFile multi("positions.dv");
+  ASSERT_EQ(multi.numPositions(), 2);
+  EXPECT_EQ(multi.planesPerPosition(), 2);
+  EXPECT_FLOAT_EQ(multi.position(1).y, 60);
+  multi.readSec(plane.data(), 1, 1, 0, 1);
+  EXPECT_EQ(plane[0], full.section_index(1, 0, 3));
+
+  std::filesystem::remove_all("positions");
+  std::vector<std::string> outputs = splitPositions("positions.dv", "positions", 2);
+  ASSERT_EQ(outputs.size(), 2u);
+  EXPECT_EQ(outputs[1], (std::filesystem::path("positions") / "positions_P2.dv").string());
+  DVFile second(outputs[1]);
+  EXPECT_EQ(second.header().num_planes(), 2);
+  EXPECT_EQ(second.header().num_times, 2);
+  EXPECT_EQ(second.header().file_type, 0);
+  for (int t = 0; t < 2; ++t) {
+    for (int w = 0; w < 2; ++w) {
+      for (int z = 0; z < 2; ++z) {
+        second.readSecAt(plane.data(), t, w, z);
+        EXPECT_EQ(plane[5], full.section_index(t, w, z + 2));
+        second.readSectionRecord(t, w, z, ival, rval);
+        EXPECT_EQ(ival[0], full.section_index(t, w, z + 2));
+        EXPECT_FLOAT_EQ(rval[kStageXFloat], 2500);
+      }
+    }
+  }
+  EXPECT_EQ(MultiPositionFile("example.dv").numPositions(), 1);
+
+  // the same stage moves in an ordinary Z stack do not make positions
+  {
+    std::fstream patch("positions.dv", std::ios::binary | std::ios::in | std::ios::out);
+    char raw[1024];
+    patch.read(raw, sizeof(raw));
+    IW_MRC_Header plain = decodeHeader(raw, false);
+    plain.file_type = 0;
+    encodeHeader(plain, hostIsBigEndian(), raw);
+    patch.seekp(0);
+    patch.write(raw, sizeof(raw));
+  }
+  MultiPositionFile stack("positions.dv");
+  EXPECT_EQ(stack.numPositions(), 1);
+  EXPECT_EQ(stack.planesPerPosition(), 4);
+}
+
+TEST(DVFileTest, TranscodeInterleave) {
+  DVFile original("example.dv");
+  int32_t ints[8], moved_ints[8];
+  std::vector<uint16_t> expected(32 * 32), actual(32 * 32);
+  for (int order = 0; order < 3; ++order) {
+    // a small buffer forces several blocks
+    TranscodeOptions options;
+    options.buffer_bytes = 5 * 2 * 32 * 32 * 2;
+    options.write_chunk = 3 * 32 * 32 * 2;
+    options.threads = 3;
+    transcodeInterleave("example.dv", "transcoded.dv", order, options);
+
+    DVFile moved("transcoded.dv");
+    EXPECT_EQ(moved.header().interleaved, order);
+    EXPECT_EQ(moved.frameSize() * 18 + moved.dataOffset(), PositionalFile("transcoded.dv").size());
+    for (int t = 0; t < 2; ++t) {
+      for (int w = 0; w < 3; ++w) {
+        for (int z = 0; z < 3; ++z) {
+          original.readSecAt(expected.data(), t, w, z);
+          moved.readSecAt(actual.data(), t, w, z);
+          ASSERT_EQ(actual, expected) << "order " << order;
+          original.readSectionRecord(t, w, z, ints, nullptr);
+          moved.readSectionRecord(t, w, z, moved_ints, nullptr);
+          ASSERT_EQ(std::memcmp(ints, moved_ints, sizeof(ints)), 0);
+        }
+      }
+    }
+  }
+
+  // writing over the source, under any name, is refused before it is truncated
+  const uint64_t size = PositionalFile("transcoded.dv").size();
+  EXPECT_THROW(transcodeInterleave("transcoded.dv", "./transcoded.dv", 0), std::runtime_error);
+  EXPECT_EQ(PositionalFile("transcoded.dv").size(), size);
+}
+
+TEST(DVFileTest, AccessHints) {
+  DVFile file("example.dv");
+  IW_MRC_Header hdr = file.getHeader();
+  auto visit = [&](int index) {
+    int t, w, z;
+    hdr.section_zwt(index, t, w, z);
+    file.setCurrentZWT(z, w, t);
+  };
+
+  file.setAccessPattern(AccessPattern::AUTO);
+  for (int i = 0; i < 3; ++i) visit(i);
+  EXPECT_EQ(file.detectedAdvice(), Advice::NORMAL);
+  visit(3);
+  EXPECT_EQ(file.detectedAdvice(), Advice::SEQUENTIAL);
+
+  // scrubbing one wavelength through Z is a constant stride of num_waves sections
+  for (int i = 0; i < 4; ++i) visit(1 + 3 * i);
+  EXPECT_EQ(file.detectedAdvice(), Advice::RANDOM);
+  for (int i : {9, 2, 14, 5}) visit(i);
+  EXPECT_EQ(file.detectedAdvice(), Advice::RANDOM);
+
+  std::vector<uint16_t> plane(32 * 32), expected(32 * 32);
+  file.readSecAt(expected.data(), 1, 2, 0);
+  file.willNeed(1, 2, 0, 3);
+  file.readSec(plane.data(), 1, 2, 0);
+  file.dontNeed(1, 2, 0);
+  EXPECT_EQ(plane, expected);
+
+  file.setAccessPattern(AccessPattern::SEQUENTIAL);
+  EXPECT_EQ(file.accessPattern(), AccessPattern::SEQUENTIAL);
+  file.readOrthoSlice(0, 0, OrthoAxis::YZ, 3, plane.data());
+  file.setAccessPattern(AccessPattern::RANDOM);
+
+  // back to AUTO: the old advice is reset and detection starts over
+  file.setAccessPattern(AccessPattern::AUTO);
+  EXPECT_EQ(file.detectedAdvice(), Advice::NORMAL);
+  for (int i = 5; i < 8; ++i) visit(i);
+  EXPECT_EQ(file.detectedAdvice(), Advice::NORMAL);
+}
+
+TEST(DVFileTest, NumaLocalBuffers) {
+  EXPECT_GE(currentNumaNode(), 0);
+  BufferPoolOptions options;
+  options.numa_local = true;
+  options.max_buffers = 4;
+  SectionBufferPool pool(32 * 32 * 2, options);
+  std::vector<SectionBuffer> held;
+  for (int i = 0; i < 4; ++i) {
+    held.push_back(pool.acquire());
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(held.back().data()) % 4096, 0u);
+  }
+  EXPECT_THROW(pool.acquire(), std::runtime_error);
+  void* first = held[0].data();
+  held.clear();
+  // freed buffers go back to their node and are reused before anything new is allocated
+  std::vector<SectionBuffer> again;
+  for (int i = 0; i < 4; ++i) again.push_back(pool.acquire());
+  EXPECT_EQ(pool.allocated(), 4u);
+  bool reused = false;
+  for (const SectionBuffer& b : again) reused |= b.data() == first;
+  EXPECT_TRUE(reused);
+
+  MappedFile map("example.dv", true);
+  DVFile file("example.dv");
+  std::vector<uint16_t> plane(32 * 32);
+  file.readSecIndexAt(plane.data(), 5);
+  EXPECT_EQ(std::memcmp(map.data() + file.dataOffset() + 5 * file.frameSize(), plane.data(),
+                        file.frameSize()),
+            0);
+
+  // a DVFile opened for huge pages maps the file the same way
+  DVFile huge("example.dv", true);
+  std::vector<uint16_t> slice(32 * 3), expected(32 * 3);
+  huge.readOrthoSlice(1, 2, OrthoAxis::YZ, 7, slice.data());
+  file.readOrthoSlice(1, 2, OrthoAxis::YZ, 7, expected.data());
+  EXPECT_EQ(slice, expected);
+}
+
+TEST(DVFileTest, LoadVolume) {
+  DVFile file("example.dv");
+  std::vector<uint16_t> plane(32 * 32);
+  for (const char* order : {"TCZ", "TZC", "CTZ", "ZCT"}) {
+    Volume volume = loadVolume(file, order, 3, 5 * 32 * 32 * 2);
+    ASSERT_EQ(volume.size(), 18u * 32 * 32 * 2);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(volume.data()) % 4096, 0u);
+    for (int t = 0; t < 2; ++t) {
+      for (int c = 0; c < 3; ++c) {
+        for (int z = 0; z < 3; ++z) {
+          file.readSecAt(plane.data(), t, c, z);
+          ASSERT_EQ(std::memcmp(volume.plane(t, c, z), plane.data(), 32 * 32 * 2), 0) << order;
+        }
+      }
+    }
+  }
+  // TCZYX is plain row-major
+  Volume tczyx = loadVolume("example.dv");
+  file.readSecAt(plane.data(), 1, 2, 1);
+  EXPECT_EQ(tczyx.as<uint16_t>()[((1 * 3 + 2) * 3 + 1) * 1024 + 77], plane[77]);
+  EXPECT_EQ(fileVolumeOrder(file.header()), "TZC");
+  EXPECT_THROW(loadVolume(file, "TTZ"), std::runtime_error);
+}
+
+TEST(DVFileTest, HeaderValidation) {
+  std::ifstream in("example.dv", std::ios::binary);
+  std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  bool big = false;
+  const IW_MRC_Header good = peekHeader(PositionalFile("example.dv"), &big);
+  EXPECT_EQ(headerProblem(good, bytes.size()), "");
+
+  // writes example.dv with a patched header (and optionally fewer bytes)
+  auto variant = [&](IW_MRC_Header hdr, size_t size) {
+    std::vector<char> copy(bytes);
+    encodeHeader(hdr, big, copy.data());
+    std::ofstream("invalid.dv", std::ios::binary | std::ios::trunc).write(copy.data(), size);
+  };
+
+  variant(good, bytes.size() - 1);
+  EXPECT_THROW(DVFile("invalid.dv"), std::runtime_error);
+  variant(good, 512);
+  EXPECT_THROW(DVFile("invalid.dv"), std::runtime_error);
+  IW_MRC_Header bad = good;
+  bad.mode = 42;
+  // probing an unknown mode must not make it look valid afterwards
+  EXPECT_EQ(getPixelTypeSize(static_cast<PixelType>(42)), 0u);
+  variant(bad, bytes.size());
+  EXPECT_THROW(DVFile("invalid.dv"), std::runtime_error);
+  bad = good;
+  bad.nz = 17;
+  variant(bad, bytes.size());
+  EXPECT_THROW(DVFile("invalid.dv"), std::runtime_error);
+  bad = good;
+  bad.interleaved = 5;
+  EXPECT_NE(headerProblem(bad, bytes.size()), "");
+  bad = good;
+  bad.nx = 1 << 30;
+  bad.ny = 1 << 30;
+  EXPECT_EQ(headerProblem(bad, bytes.size()), "data runs past the end of the file");
+
+  // cached dimensions reject negative and past-the-end indices alike
+  DVFile file("example.dv");
+  std::vector<uint16_t> plane(32 * 32);
+  EXPECT_THROW(file.readSecAt(plane.data(), -1, 0, 0), std::runtime_error);
+  EXPECT_THROW(file.readSecAt(plane.data(), 0, 3, 0), std::runtime_error);
+  EXPECT_THROW(file.readSecAt(plane.data(), 0, 0, -2), std::runtime_error);
+  EXPECT_NO_THROW(file.readSecAt(plane.data(), 1, 2, 2));
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -0,0 +1,130 @@
+// Full-volume scan benchmark: how buffer placement and mapping options affect throughput.
+//
+//   dvbench <in.dv> [threads] [repeats]
+//
+// Every variant sums all sections of the file with `threads` workers. Run it on a file larger
+// than the page cache (or drop caches between runs) to measure the disk rather than memory.
+//
+//   read/heap      readSecAt into a std::vector per worker
+//   read/pool      readSecAt into buffers from a SectionBufferPool
+//   read/numa      as above with numa_local, so buffers live on the consuming thread's node
+//   read/huge      as above with huge page buffers
+//   mmap/4k        sum straight out of a memory map of the file
+//   mmap/huge      as above with the map backed by transparent huge pages
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "dvbuffers.h"
+#include "dvfile.h"
+#include "dvparallel.h"
+
+namespace {
+
+uint64_t sumBytes(const uint8_t* p, size_t n) {
+  uint64_t sum = 0;
+  for (size_t i = 0; i < n; ++i) sum += p[i];
+  return sum;
+}
+
+// seconds taken by fn, best of `repeats`
+template <typename F>
+double best(int repeats, F&& fn) {
+  double best = 1e300;
+  for (int r = 0; r < repeats; ++r) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    best = std::min(best, elapsed.count());
+  }
+  return best;
+}
+
+void report(const char* name, double seconds, uint64_t bytes) {
+  std::cout << std::left << std::setw(12) << name << std::right << std::setw(10) << std::fixed
+            << std::setprecision(1) << bytes / seconds / (1 << 20) << " MB/s" << std::endl;
+}
+
+double scanPool(const DVFile& file, unsigned threads, int repeats,
+                const BufferPoolOptions& options) {
+  SectionBufferPool pool(file, options);
+  const size_t n = static_cast<size_t>(file.header().nz);
+  return best(repeats, [&] {
+    std::atomic<uint64_t> total{0};
+    parallelForStealing(
+        n,
+        [&](size_t i, unsigned) {
+          SectionBuffer buffer = pool.acquire();
+          file.readSecIndexAt(buffer.data(), static_cast<int>(i));
+          total += sumBytes(buffer.as<uint8_t>(), buffer.size());
+        },
+        threads);
+  });
+}
+
+double scanMap(const DVFile& file, const std::string& path, unsigned threads, int repeats,
+               bool hugepages) {
+  MappedFile map(path, hugepages);
+  const size_t n = static_cast<size_t>(file.header().nz);
+  return best(repeats, [&] {
+    std::atomic<uint64_t> total{0};
+    parallelForStealing(
+        n,
+        [&](size_t i, unsigned) {
+          total += sumBytes(map.data() + file.dataOffset() + i * file.frameSize(),
+                            file.frameSize());
+        },
+        threads);
+  });
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 2 || argc > 4) {
+    std::cerr << "Usage: dvbench <in.dv> [threads] [repeats]" << std::endl;
+    return 2;
+  }
+  try {
+    const std::string path = argv[1];
+    const unsigned threads = argc > 2 ? std::atoi(argv[2]) : defaultThreadCount();
+    const int repeats = argc > 3 ? std::atoi(argv[3]) : 3;
+    DVFile file(path);
+    const size_t n = static_cast<size_t>(file.header().nz);
+    const uint64_t bytes = static_cast<uint64_t>(n) * file.frameSize();
+    std::cout << path << ": " << n << " sections, " << bytes / (1 << 20) << " MB, " << threads
+              << " threads, NUMA node of main thread " << currentNumaNode() << std::endl;
+
+    std::vector<std::vector<uint8_t>> heap(threads ? threads : defaultThreadCount());
+    report("read/heap", best(repeats, [&] {
+             std::atomic<uint64_t> total{0};
+             parallelForStealing(
+                 n,
+                 [&](size_t i, unsigned worker) {
+                   heap[worker].resize(file.frameSize());
+                   file.readSecIndexAt(heap[worker].data(), static_cast<int>(i));
+                   total += sumBytes(heap[worker].data(), heap[worker].size());
+                 },
+                 threads);
+           }),
+           bytes);
+
+    BufferPoolOptions options;
+    report("read/pool", scanPool(file, threads, repeats, options), bytes);
+    options.numa_local = true;
+    report("read/numa", scanPool(file, threads, repeats, options), bytes);
+    options.numa_local = false;
+    options.hugepages = true;
+    report("read/huge", scanPool(file, threads, repeats, options), bytes);
+    report("mmap/4k", scanMap(file, path, threads, repeats, false), bytes);
+    report("mmap/huge", scanMap(file, path, threads, repeats, true), bytes);
+  } catch (const std::exception& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,160 @@
+// Command line front end for the dvfile utilities.
+//
+//   dvtool compress <in.dv> <out.dvz> [tile_x tile_y]
+//   dvtool zarr <in.dv> <out.zarr> [chunk_z chunk_y chunk_x]
+//   dvtool tiff <in.dv> <out.ome.tif> [tile_size] [--packbits]
+//   dvtool checksum <in.dv> [sidecar]
+//   dvtool verify <in.dv> [sidecar]
+//   dvtool compare <reference.dv> <test.dv> [--exact]
+//   dvtool transcode <in.dv> <out.dv> <ZTW|WZT|ZWT>
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "dvchecksum.h"
+#include "dvcompare.h"
+#include "dvcompress.h"
+#include "dvfile.h"
+#include "dvtiff.h"
+#include "dvtranscode.h"
+#include "dvzarr.h"
+
+namespace {
+
+int usage() {
+  std::cerr << "Usage:\n"
+            << "  dvtool compress <in.dv> <out.dvz> [tile_x tile_y]\n"
+            << "  dvtool zarr <in.dv> <out.zarr> [chunk_z chunk_y chunk_x]\n"
+            << "  dvtool tiff <in.dv> <out.ome.tif> [tile_size] [--packbits]\n"
+            << "  dvtool checksum <in.dv> [sidecar]\n"
+            << "  dvtool verify <in.dv> [sidecar]\n"
+            << "  dvtool compare <reference.dv> <test.dv> [--exact]\n"
+            << "  dvtool transcode <in.dv> <out.dv> <ZTW|WZT|ZWT>\n";
+  return 2;
+}
+
+int compressCommand(int argc, char** argv) {
+  if (argc != 4 && argc != 6) return usage();
+  int tile_x = argc == 6 ? std::atoi(argv[4]) : 0;
+  int tile_y = argc == 6 ? std::atoi(argv[5]) : 0;
+  compressDVFile(argv[2], argv[3], tile_x, tile_y);
+  DVCompressedFile packed(argv[3]);
+  std::cout << argv[3] << ": compression ratio " << packed.compressionRatio() << std::endl;
+  return 0;
+}
+
+int zarrCommand(int argc, char** argv) {
+  if (argc != 4 && argc != 7) return usage();
+  ZarrOptions options;
+  if (argc == 7) {
+    options.chunk_z = std::atoi(argv[4]);
+    options.chunk_y = std::atoi(argv[5]);
+    options.chunk_x = std::atoi(argv[6]);
+  }
+  convertToZarr(argv[2], argv[3], options);
+  return 0;
+}
+
+int tiffCommand(int argc, char** argv) {
+  if (argc < 4 || argc > 6) return usage();
+  TiffOptions options;
+  for (int i = 4; i < argc; ++i) {
+    if (std::string(argv[i]) == "--packbits") {
+      options.packbits = true;
+    } else {
+      options.tile_size = std::atoi(argv[i]);
+    }
+  }
+  exportBigTiff(argv[2], argv[3], options);
+  return 0;
+}
+
+int checksumCommand(int argc, char** argv) {
+  if (argc != 3 && argc != 4) return usage();
+  writeChecksums(argv[2], argc == 4 ? argv[3] : "");
+  return 0;
+}
+
+// exits with 1 if anything is damaged, listing the affected sections
+int verifyCommand(int argc, char** argv) {
+  if (argc != 3 && argc != 4) return usage();
+  bool header_ok = true;
+  std::vector<DamagedSection> damaged =
+      verifyChecksums(argv[2], argc == 4 ? argv[3] : "", 0, &header_ok);
+  if (!header_ok) std::cout << argv[2] << ": header damaged" << std::endl;
+  for (const DamagedSection& d : damaged) {
+    std::cout << argv[2] << ": section t=" << d.t << " w=" << d.w << " z=" << d.z
+              << (d.readable ? " damaged" : " missing") << std::endl;
+  }
+  if (header_ok && damaged.empty()) {
+    std::cout << argv[2] << ": OK" << std::endl;
+    return 0;
+  }
+  return 1;
+}
+
+// exits with 1 if the files differ
+int compareCommand(int argc, char** argv) {
+  if (argc != 4 && argc != 5) return usage();
+  CompareOptions options;
+  if (argc == 5) {
+    if (std::string(argv[4]) != "--exact") return usage();
+    options.exact = true;
+  }
+  CompareResult result = compareDVFiles(argv[2], argv[3], options);
+  if (!result.same_shape) {
+    std::cout << "files differ in shape or pixel type" << std::endl;
+    return 1;
+  }
+  for (const PlaneDiff& d : result.planes) {
+    if (d.equal) continue;
+    std::cout << "t=" << d.t << " w=" << d.w << " z=" << d.z;
+    if (!options.exact) {
+      std::cout << " max " << d.max_abs_diff << " rmse " << d.rmse << " psnr " << d.psnr;
+    }
+    std::cout << std::endl;
+  }
+  if (result.identical) {
+    std::cout << "identical" << std::endl;
+    return 0;
+  }
+  if (!options.exact) {
+    std::cout << "total: max " << result.max_abs_diff << " rmse " << result.rmse << " psnr "
+              << result.psnr << std::endl;
+  }
+  return 1;
+}
+
+int transcodeCommand(int argc, char** argv) {
+  if (argc != 5) return usage();
+  const std::string order = argv[4];
+  const char* names[] = {"ZTW", "WZT", "ZWT"};
+  for (int i = 0; i < 3; ++i) {
+    if (order == names[i]) {
+      transcodeInterleave(argv[2], argv[3], i);
+      return 0;
+    }
+  }
+  return usage();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 2) return usage();
+  std::string command = argv[1];
+  try {
+    if (command == "compress") return compressCommand(argc, argv);
+    if (command == "zarr") return zarrCommand(argc, argv);
+    if (command == "tiff") return tiffCommand(argc, argv);
+    if (command == "checksum") return checksumCommand(argc, argv);
+    if (command == "verify") return verifyCommand(argc, argv);
+    if (command == "compare") return compareCommand(argc, argv);
+    if (command == "transcode") return transcodeCommand(argc, argv);
+  } catch (const std::exception& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+  return usage();
+}